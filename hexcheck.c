@@ -0,0 +1,77 @@
+/*! Check of the hex codec (make check).
+ *
+ * rc4hex.c is included to reach its static implementations: every SIMD
+ * version the CPU supports is compared with the scalar one on random
+ * buffers of random lengths (both cases, then an invalid digit at a random
+ * position), and every character is tried at a vector and a tail position.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "rc4hex.c"
+
+#define MAXN 300
+#define TRIALS 20000
+
+typedef struct {
+    const char *name;
+    int (*decode)(const char *, size_t, unsigned char *);
+    void (*encode)(const unsigned char *, size_t, char *);
+} codec;
+
+static int check(const codec *c) {
+    unsigned char in[MAXN], out[MAXN], ref[MAXN];
+    char hex[2 * MAXN + 1], rhex[2 * MAXN + 1];
+    static const char bad[] = "gG/:@`\x7f\x80 \xff";
+    for (int t = 0; t < TRIALS; t++) {
+        size_t n = rand() % MAXN;
+        for (size_t i = 0; i < n; i++) in[i] = rand();
+        c->encode(in, n, hex);
+        encode_scalar(in, n, rhex);
+        if (memcmp(hex, rhex, 2 * n)) {
+            printf("%s: encoding of %zu bytes differs\n", c->name, n);
+            return 0;
+        }
+        for (size_t i = 0; i < 2 * n; i++) if (rand() & 1) hex[i] = tolower(hex[i]);
+        if (!c->decode(hex, n, out) || memcmp(in, out, n)) {
+            printf("%s: decoding of %zu bytes fails\n", c->name, n);
+            return 0;
+        }
+        if (!n) continue;
+        size_t p = rand() % (2 * n);
+        hex[p] = bad[rand() % (sizeof(bad) - 1)];
+        if (c->decode(hex, n, out) || decode_scalar(hex, n, ref)) {
+            printf("%s: invalid digit %02X at %zu of %zu accepted\n", c->name, (unsigned char)hex[p], p, 2 * n);
+            return 0;
+        }
+    }
+    for (int ch = 0; ch < 256; ch++)
+        for (size_t p = 5; p < 2 * 45; p += 84) {
+            char h[2 * 45];
+            memset(h, '0', sizeof(h));
+            h[p] = ch;
+            int r = c->decode(h, 45, out);
+            if (r != decode_scalar(h, 45, ref) || (r && memcmp(out, ref, 45))) {
+                printf("%s: character %02X at %zu differs\n", c->name, ch, p);
+                return 0;
+            }
+        }
+    printf("%s: ok\n", c->name);
+    return 1;
+}
+
+int main(void) {
+    codec codecs[3];
+    int n = 0, ok = 1;
+    codecs[n++] = (codec){"scalar", decode_scalar, encode_scalar};
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) codecs[n++] = (codec){"ssse3", decode_ssse3, encode_ssse3};
+    if (__builtin_cpu_supports("avx2")) codecs[n++] = (codec){"avx2", decode_avx2, encode_avx2};
+#endif
+    srand(1);
+    for (int i = 0; i < n; i++) ok &= check(&codecs[i]);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+//! Low-overhead per-phase instrumentation for the attack programs.
+//
+// Everything here is compiled out unless PROF is defined (e.g. gcc -DPROF ...).
+// Each phase keeps an event count, the total/min/max time spent in it and a
+// log2 histogram of the individual durations. Time is measured in TSC cycles
+// on x86 and in nanoseconds (clock_gettime) elsewhere. Plain counters are also
+// available, and are reported together with their rate per wall-clock second.
+//
+// Statistics are kept per thread (no locking in the hot path) and merged when
+// they are dumped as JSON at exit, to the file named by the PROF_OUT
+// environment variable or to stderr.
+//
+// Usage:
+//   prof_init(phase_names,nphases,counter_names,ncounters);
+//   PROF_BEGIN(ph); ... PROF_END(ph);
+//   PROF_COUNT(ctr,n);
+
+#ifndef PROF_H
+#define PROF_H
+
+#ifdef PROF
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#define PROF_MAXPH 16      // Maximum number of phases
+#define PROF_MAXCNT 16     // Maximum number of counters
+#define PROF_HBINS 40      // Histogram bins (bin b holds durations in [2^(b-1),2^b))
+
+static inline uint64_t prof_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000u+ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROF_TICKS() __rdtsc()
+#define PROF_UNIT "cycles"
+#else
+#define PROF_TICKS() prof_ns()
+#define PROF_UNIT "ns"
+#endif
+
+struct prof_phase {
+    uint64_t n,total,min,max;
+    uint64_t hist[PROF_HBINS];
+};
+
+struct prof_block {
+    struct prof_phase ph[PROF_MAXPH];
+    uint64_t cnt[PROF_MAXCNT];
+    struct prof_block *next;
+};
+
+static struct prof_block *prof_all;       // All per-thread blocks (never freed)
+static __thread struct prof_block *prof_tls;
+static const char *const *prof_phnames;
+static const char *const *prof_cnames;
+static int prof_nph,prof_ncnt;
+static uint64_t prof_t0;
+
+static struct prof_block *prof_block_new(void) {
+    struct prof_block *b=(struct prof_block *)calloc(1,sizeof(struct prof_block));
+    if (!b) {
+        fprintf(stderr,"prof: out of memory\n");
+        exit(1);
+    }
+    b->next=__atomic_load_n(&prof_all,__ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&prof_all,&b->next,b,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED));
+    return b;
+}
+
+static inline struct prof_block *prof_self(void) {
+    if (!prof_tls) prof_tls=prof_block_new();
+    return prof_tls;
+}
+
+static inline void prof_record(int ph,uint64_t dt) {
+    struct prof_phase *p=&prof_self()->ph[ph];
+    int b=dt?64-__builtin_clzll(dt):0;
+    if (b>=PROF_HBINS) b=PROF_HBINS-1;
+    if (!p->n || dt<p->min) p->min=dt;
+    if (dt>p->max) p->max=dt;
+    p->n++;
+    p->total+=dt;
+    p->hist[b]++;
+}
+
+static inline void prof_count(int c,uint64_t n) {
+    prof_self()->cnt[c]+=n;
+}
+
+static void prof_dump(void) {
+    double wall=(prof_ns()-prof_t0)*1e-9;
+    struct prof_phase ph[PROF_MAXPH]={{0}};
+    uint64_t cnt[PROF_MAXCNT]={0};
+    for (struct prof_block *b=__atomic_load_n(&prof_all,__ATOMIC_ACQUIRE);b;b=b->next) {
+        for (int i=0;i<prof_nph;i++) {
+            const struct prof_phase *p=&b->ph[i];
+            if (!p->n) continue;
+            if (!ph[i].n || p->min<ph[i].min) ph[i].min=p->min;
+            if (p->max>ph[i].max) ph[i].max=p->max;
+            ph[i].n+=p->n;
+            ph[i].total+=p->total;
+            for (int h=0;h<PROF_HBINS;h++) ph[i].hist[h]+=p->hist[h];
+        }
+        for (int i=0;i<prof_ncnt;i++) cnt[i]+=b->cnt[i];
+    }
+    const char *name=getenv("PROF_OUT");
+    FILE *f=name && *name?fopen(name,"w"):NULL;
+    if (!f) f=stderr;
+    fprintf(f,"{\"unit\":\"%s\",\"wall_s\":%.6f,\"phases\":{",PROF_UNIT,wall);
+    for (int i=0;i<prof_nph;i++) {
+        fprintf(f,"%s\n  \"%s\":{\"count\":%llu,\"total\":%llu,\"mean\":%.1f,\"min\":%llu,\"max\":%llu,\"hist\":[",
+            i?",":"",prof_phnames[i],(unsigned long long)ph[i].n,(unsigned long long)ph[i].total,
+            ph[i].n?ph[i].total/(double)ph[i].n:0.0,(unsigned long long)ph[i].min,(unsigned long long)ph[i].max);
+        int last=PROF_HBINS-1;
+        while (last>0 && !ph[i].hist[last]) last--;
+        for (int h=0;h<=last;h++) fprintf(f,"%s%llu",h?",":"",(unsigned long long)ph[i].hist[h]);
+        fprintf(f,"]}");
+    }
+    fprintf(f,"},\"counters\":{");
+    for (int i=0;i<prof_ncnt;i++)
+        fprintf(f,"%s\n  \"%s\":{\"total\":%llu,\"per_s\":%.1f}",i?",":"",prof_cnames[i],
+            (unsigned long long)cnt[i],wall>0?cnt[i]/wall:0.0);
+    fprintf(f,"}}\n");
+    if (f!=stderr) fclose(f);
+}
+
+static void prof_init(const char *const *phases,int nph,const char *const *counters,int ncnt) {
+    prof_phnames=phases;
+    prof_nph=nph<PROF_MAXPH?nph:PROF_MAXPH;
+    prof_cnames=counters;
+    prof_ncnt=ncnt<PROF_MAXCNT?ncnt:PROF_MAXCNT;
+    prof_t0=prof_ns();
+    atexit(prof_dump);
+}
+
+#define PROF_BEGIN(ph) uint64_t prof_t_##ph=PROF_TICKS()
+#define PROF_END(ph) prof_record(ph,PROF_TICKS()-prof_t_##ph)
+#define PROF_COUNT(c,n) prof_count(c,n)
+#define PROF_INIT(ph,nph,c,nc) prof_init(ph,nph,c,nc)
+
+#else
+
+#define PROF_BEGIN(ph) do {} while (0)
+#define PROF_END(ph) do {} while (0)
+#define PROF_COUNT(c,n) do {} while (0)
+#define PROF_INIT(ph,nph,c,nc) do {} while (0)
+
+#endif
+
+#endif
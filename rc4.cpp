@@ -10,49 +10,94 @@
 // noticeable probability.
 //
 // There are many known attacks that are far more powerful than this toy example.
+//
+// Build: make rc4   (make PROF=1 for phase instrumentation, see prof.h)
 
 extern "C" {
     #include <stdlib.h>
     #include <stdio.h>
     #include <time.h>
     #include <string.h>
+    #include <stdint.h>
+    #include <limits.h>
+    #include <math.h>
+    #include <unistd.h>
+    #include <errno.h>
+    #include <poll.h>
+    #include <netdb.h>
+    #include <signal.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <sys/wait.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <sched.h>
+    #include <pthread.h>
 }
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include "prof.h"
+#include "rc4core.h"
+#include "rc4lab.h"
 
-const int l=8;     // Bitlength of the elements (words)
-const int L=1<<l;  // Number of elements
-const int M=L-1;   // Binary mask for elements
+const int minl=4;  // Smallest prebuilt word size (option -w)
+const int maxl=16; // Largest prebuilt word size
 
-int S[L];          // RC4 state (permutation)
-int K[L];          // RC4 Expanded (repeated) IV+key
-int F[L];          // Transposition counters (debug)
-int freq[L];       // Frequency counters (attack)
-int I,J;           // RC4 indices
-int key[L];        // Long-term key
-int IV[L];         // Initialization vector
+int wordbits=8;    // Bitlength of the elements (words) selected at run time
 
 int keylen=5;      // Length (in words) of the long-term key
 int IVlen=3;       // Length (in words) od the Initialization Vector
+int nivs=0;        // Number of magic IVs used per key word (0: all of them)
+
+// Instrumented phases and counters (see prof.h, only active with -DPROF)
+
+enum {PH_KEYGEN,PH_EXPANDKEY,PH_INITPERM,PH_GENBYTE,PH_VOTE,PH_ARGMAX,NPHASES};
+enum {CNT_KSA,CNT_TRIALS,NCOUNTERS};
+#ifdef PROF
+const char *const phasenames[NPHASES]={"keygen","expandkey","initperm","genbyte","vote","argmax"};
+const char *const counternames[NCOUNTERS]={"ksa","trials"};
+#endif
 
-// Tracing functions (for debugging purposes)
+// Random number streams.
+// Each trial draws from its own splitmix64 stream, derived from the global
+// seed and the trial number, so results don't depend on how trials are
+// scheduled on threads, and all the cells of a sweep attack the same keys.
 
-void report(const char *name,const int *X) {
-    printf(" *** %s = [",name);
-    for (int n=0;n<L;n++) {
-        if (!(n&0x0F)) printf("\n    ");
-        printf("%02X ",X[n]);
+struct rng {
+    uint64_t s;
+    rng(uint64_t seed=0,uint64_t stream=0) {s=seed^(stream*0xD1B54A32D192ED03ULL);}
+    uint64_t next() {
+        uint64_t z=(s+=0x9E3779B97F4A7C15ULL);
+        z=(z^(z>>30))*0xBF58476D1CE4E5B9ULL;
+        z=(z^(z>>27))*0x94D049BB133111EBULL;
+        return z^(z>>31);
     }
-    printf("\n]\n");
+    int word() {return int(next()>>33);}
+};
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
 }
 
-void reportS() {report("PERM",S);}
-void reportK() {report("KEY",K);}
-void reportF() {report("SWAP FREQ",F);}
+uint64_t seed;     // Global seed (option -r, default: time)
 
-// Generate a random long-term key
+// Counters shared by the threads of a pool get a cache line of their own, so
+// that updating them does not invalidate the lines of the per-thread state.
 
-void randkey() {
-    for (int i=0;i<keylen;i++) key[i]=rand()&M;
-}
+template<class T>
+struct alignas(64) padded {
+    T v;
+};
 
 // Restrict to printable (alphanumeric) characters (only valid for l=8)
 
@@ -65,13 +110,6 @@ char makeprintable(int x) {
     return 'a'+x;
 }
 
-void randpkey() {
-    for (int i=0;i<keylen;i++) key[i]=makeprintable(rand());
-//    printf("[");
-//    for (int i=0;i<keylen;i++) printf("%c",key[i]);
-//    printf("]");
-}
-
 int isprintable(char c) {
     if (c<'0') return 0;
     if (c<='9') return 1;
@@ -82,125 +120,6 @@ int isprintable(char c) {
     return 0;
 }
 
-// RC4 implementation
-
-void expandkey() {
-    int seedlen=keylen+IVlen;
-    for (I=0,J=0;I<IVlen;I++,J++) K[J]=IV[I]&M;
-    for (I=0;I<keylen;I++,J++) K[J]=key[I]&M;
-    for (;J<L;J++) K[J]=K[J%seedlen];
-}
-
-void swap() {
-//printf("        (%02X,%02X)\n",I,J);
-    if (I!=J) {F[I]++;F[J]++;}
-    int T=S[I];
-    S[I]=S[J];
-    S[J]=T;
-}
-void initperm() {
-    for (I=0;I<L;I++) F[I]=0;
-    for (I=0;I<L;I++) S[I]=I;
-//reportS();
-    J=0;
-    for (I=0;I<L;I++) {
-        J+=S[I]+K[I];J&=M;
-        swap();
-//reportS();
-    }
-    I=0;J=0;
-}
-
-unsigned char genbyte() {
-    I++;I&=M;
-    J+=S[I];J&=M;
-    swap();
-    return S[(S[I]+S[J])&M];
-}
-
-// Generate test vectors
-
-int offsets[]={0,16,240,256,496,512,752,768,1008,1024,1520,1536,2032,2048,3056,3072,4080,4096,-1};
-
-void testvector(int len,int *p) {
-    IVlen=0;
-    keylen=len;
-    for (int i=0;i<keylen;i++) key[i]=p[i];
-    printf("\nKey length: %d bits.\n",l*keylen);
-    printf("key: 0x");
-    for (int i=0;i<keylen;i++) printf("%02x",key[i]);
-    printf("\n");
-    expandkey();
-    initperm();
-    int lastoffs=0;
-    for (int n=0;offsets[n]>=0;n++) {
-        for (int i=offsets[n];i>lastoffs;i--) genbyte();
-        lastoffs=offsets[n];
-        printf("\nDEC %4d HEX %4x: ",lastoffs,lastoffs);
-        for (int i=0;i<4;i++) printf("%02x ",genbyte());
-        printf(" ");
-        for (int i=0;i<4;i++) printf("%02x ",genbyte());
-        printf("  ");
-        for (int i=0;i<4;i++) printf("%02x ",genbyte());
-        printf(" ");
-        for (int i=0;i<4;i++) printf("%02x ",genbyte());
-        lastoffs+=16;
-    }
-    printf("\n");
-}
-
-int testkey0[]={1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,
-    17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,32};
-int testkey5[]={0x83,0x32,0x22,0x77,0x2a};
-int testkey7[]={0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
-int testkey8[]={
-    0x64,0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
-int testkey10[]={
-    0x8b,0x37,0x64,0x19,0x10,0x83,0x32,0x22,
-    0x77,0x2a};
-int testkey16[]={
-    0xeb,0xb4,0x62,0x27,0xc6,0xcc,0x8b,0x37,
-    0x64,0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
-int testkey24[]={
-    0xc1,0x09,0x16,0x39,0x08,0xeb,0xe5,0x1d,
-    0xeb,0xb4,0x62,0x27,0xc6,0xcc,0x8b,0x37,
-    0x64,0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
-int testkey32[]={
-    0x1a,0xda,0x31,0xd5,0xcf,0x68,0x82,0x21,
-    0xc1,0x09,0x16,0x39,0x08,0xeb,0xe5,0x1d,
-    0xeb,0xb4,0x62,0x27,0xc6,0xcc,0x8b,0x37,
-    0x64,0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
-
-
-void testvectors() {
-    printf("\nThis must produce the test vectors in https://tools.ietf.org/html/rfc6229\n");
-    testvector(5,testkey0);
-    testvector(7,testkey0);
-    testvector(8,testkey0);
-    testvector(10,testkey0);
-    testvector(16,testkey0);
-    testvector(24,testkey0);
-    testvector(32,testkey0);
-    testvector(5,testkey5);
-    testvector(7,testkey7);
-    testvector(8,testkey8);
-    testvector(10,testkey10);
-    testvector(16,testkey16);
-    testvector(24,testkey24);
-    testvector(32,testkey32);
-}
-
-// Generate just the first word of the RC4 key stream
-
-int testRC4() {
-    expandkey();
-//reportK();
-    initperm();
-//reportS();
-//reportF();
-    return genbyte();
-}
-
 // First word guessing attack, based on special values for the IV.
 // From the first word of the key streams for L different IV
 // the function outputs a guess based on the most repeated value.
@@ -242,31 +161,1179 @@ bool onlyprintable=false;
 int verbosity=0;
 bool onlytest=false;
 bool onlyhelp=false;
+bool onlyexact=false;
+const char *sweepgrid=0;
+const char *csvname=0;
+int nthreads=0;
+bool pinthreads=false;     // Pin the pool threads to CPUs (-a)
+bool scalingbench=false;   // Core scaling benchmark (-B)
+const char *biasspec=0;    // Keystream positions analysed (-A)
+const char *coordaddr=0;   // Coordinator address (-C)
+const char *workeraddr=0;  // Coordinator a worker connects to (-W)
+int nforks=0;              // Local worker processes started by the coordinator (-F)
+int workerfd=-1;           // Connection of a worker to its coordinator
+std::string workerbuf;     // Data received from it and not yet read
+
+// Attack state of one thread: the cipher, the attacked key and the guess.
+// Aligned to cache lines, so that the states of two threads never share one.
+
+template<int l>
+struct alignas(64) attack {
+    static const int L=RC4<l>::L;
+    static const int M=RC4<l>::M;
+
+    RC4<l> rc;
+    int key[L];        // Long-term key
+    int IV[L];         // Initialization vector
+    int freq[L];       // Frequency counters (attack)
+    int gk[L];         // Guessed long-term key
+    int keylen=::keylen;
+    int nivs=::nivs;
+    bool onlyprintable=::onlyprintable;
+    rng trialrng;      // Stream of the running trial
+
+    // Generate a random long-term key
+
+    void randkey() {
+        PROF_BEGIN(PH_KEYGEN);
+        for (int i=0;i<keylen;i++) key[i]=trialrng.word()&M;
+        PROF_END(PH_KEYGEN);
+    }
+
+    void randpkey() {
+        PROF_BEGIN(PH_KEYGEN);
+        for (int i=0;i<keylen;i++) key[i]=makeprintable(trialrng.word());
+        PROF_END(PH_KEYGEN);
+    }
+
+    // Generate just the first word of the RC4 key stream
+
+    int testRC4() {
+        PROF_BEGIN(PH_EXPANDKEY);
+        rc.expandkey(IV,IVlen,key,keylen);
+        PROF_END(PH_EXPANDKEY);
+        PROF_BEGIN(PH_INITPERM);
+        rc.initperm();
+        PROF_END(PH_INITPERM);
+        PROF_COUNT(CNT_KSA,1);
+        PROF_BEGIN(PH_GENBYTE);
+        int z=rc.genbyte();
+        PROF_END(PH_GENBYTE);
+        return z;
+    }
 
-int gk[L]; // Guessed long-term key
-
-void guesskey() {
-    int ofs=3;
-    for (int n=0;n<keylen;n++) {
-        ofs+=n+3;
-        for (int i=0;i<L;i++) freq[i]=0;
-        for (int i=0;i<L;i++) {
-            IV[0]=(n+3)&M;
-            IV[1]=(-1)&M;
-            IV[2]=i&M;
-            freq[(testRC4()-ofs-i)&M]++;
+    // When fewer than L IVs are used per key word (0<nivs<L), they are a random
+    // subset of the L magic IVs: x runs through an odd-stride arithmetic
+    // progression with a random start. Every vote adds its log-likelihood
+    // weight (see fmsweight()), so the most voted value is the most likely one.
+
+    void guesskey() {
+        int ofs=3;
+        int niv=nivs>0 && nivs<L?nivs:L;
+        for (int n=0;n<keylen;n++) {
+            ofs+=n+3;
+            for (int i=0;i<L;i++) freq[i]=0;
+            int x0=0,step=1;
+            if (niv<L) {
+                x0=trialrng.word()&M;
+                step=(trialrng.word()|1)&M;
+            }
+            for (int k=0;k<niv;k++) {
+                int i=(x0+k*step)&M;
+                IV[0]=(n+3)&M;
+                IV[1]=(-1)&M;
+                IV[2]=i&M;
+                int z=testRC4();
+                PROF_BEGIN(PH_VOTE);
+                freq[(z-ofs-i)&M]+=fmsweight<l>(n,i);
+                PROF_END(PH_VOTE);
+            }
+            PROF_BEGIN(PH_ARGMAX);
+            int fmax=0;
+            int fmaxind=0;
+            for (int i=0;i<L;i++)
+                if ((!onlyprintable || isprintable(i)) && freq[i]>fmax) {
+                    fmax=freq[i];
+                    fmaxind=i;
+                }
+            PROF_END(PH_ARGMAX);
+            if (verbosity>0) printf("    Max score %d detected at %02X (key[%d]=%02X)\n",fmax,fmaxind,n,key[n]);
+            gk[n]=fmaxind;
+            ofs+=fmaxind;
+        }
+    }
+
+    // Run trial number t: generate its key and attack it.
+    // Returns the length of the correctly guessed key prefix.
+
+    int trial(uint64_t t) {
+        trialrng=rng(seed,t);
+        if (onlyprintable) randpkey(); else randkey();
+        guesskey();
+        PROF_COUNT(CNT_TRIALS,1);
+        int ok;
+        for (ok=0;ok<keylen && key[ok]==gk[ok];ok++);
+        return ok;
+    }
+};
+
+// Fixed pool of worker threads. run() hands the same job to every worker
+// and waits until all of them return, so the threads are reused across jobs.
+// With -a, thread i is pinned to the i-th CPU the process may run on (modulo
+// their number), so it keeps its caches. The jobs allocate the per-thread
+// state themselves on their first run: the pages are then first touched by
+// the pinned thread, and the kernel places them on its NUMA node.
+
+int defaultthreads() {
+    return nthreads>0?nthreads:std::max(1u,std::thread::hardware_concurrency());
+}
+
+class workerpool {
+    std::vector<std::thread> th;
+    std::vector<int> cpus;
+    std::mutex mx;
+    std::condition_variable start,done;
+    std::function<void(int)> job;
+    unsigned gen=0;
+    int busy=0;
+    bool quit=false;
+
+    void pin(int id) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[id%cpus.size()],&set);
+        if (int e=pthread_setaffinity_np(pthread_self(),sizeof(set),&set))
+            fprintf(stderr,"Cannot pin thread %d to CPU %d: %s\n",id,cpus[id%cpus.size()],strerror(e));
+    }
+    void loop(int id) {
+        unsigned seen=0;
+        if (!cpus.empty()) pin(id);
+        std::unique_lock<std::mutex> lk(mx);
+        for (;;) {
+            start.wait(lk,[&]{return quit || gen!=seen;});
+            if (quit) return;
+            seen=gen;
+            lk.unlock();
+            job(id);
+            lk.lock();
+            if (--busy==0) done.notify_all();
+        }
+    }
+public:
+    explicit workerpool(int n,bool pinned=pinthreads) {
+        cpu_set_t set;
+        if (pinned && !sched_getaffinity(0,sizeof(set),&set))
+            for (int c=0;c<CPU_SETSIZE;c++) if (CPU_ISSET(c,&set)) cpus.push_back(c);
+        for (int i=0;i<n;i++) th.emplace_back(&workerpool::loop,this,i);
+    }
+    ~workerpool() {
+        {std::lock_guard<std::mutex> lk(mx); quit=true;}
+        start.notify_all();
+        for (auto &t:th) t.join();
+    }
+    int size() const {return th.size();}
+    void run(const std::function<void(int)> &f) {
+        std::unique_lock<std::mutex> lk(mx);
+        job=f;
+        busy=th.size();
+        gen++;
+        start.notify_all();
+        done.wait(lk,[&]{return busy==0;});
+    }
+};
+
+
+// Success rate sweep.
+// The grid is given as IVS:KEYLENS[:PRINTABLE], each field a comma separated
+// list (e.g. "32,64,128,256:5,13:0,1"). Each cell of the grid runs niter
+// trials (a Monte Carlo batch shared among the pool threads) and one CSV line
+// is written per cell and key prefix length, with 95% Wilson score intervals.
+
+int parselist(const char *s,const char **end,int *v,int maxn) {
+    int n=0;
+    while (n<maxn) {
+        char *e;
+        v[n++]=strtol(s,&e,0);
+        if (e==s) {
+            fprintf(stderr,"Badly formed sweep grid\n");
+            exit(1);
+        }
+        s=e;
+        if (*s!=',') break;
+        s++;
+    }
+    *end=s;
+    return n;
+}
+
+void wilson(long k,long n,double *lo,double *hi) {
+    const double z=1.96;
+    double p=k/double(n);
+    double d=1+z*z/n;
+    double c=(p+z*z/(2*n))/d;
+    double h=z*sqrt(p*(1-p)/n+z*z/(4.0*n*n))/d;
+    *lo=c-h<0?0:c-h;
+    *hi=c+h>1?1:c+h;
+}
+
+template<int l>
+void sweep(int niter) {
+    const int L=RC4<l>::L;
+    const int maxn=64;
+    int ivs[maxn],kls[maxn],prs[2]={0};
+    int nivl,nkl,npr=1;
+    const char *g=sweepgrid;
+    nivl=parselist(g,&g,ivs,maxn);
+    if (*g++!=':') {
+        fprintf(stderr,"Badly formed sweep grid (expected IVS:KEYLENS[:PRINTABLE])\n");
+        exit(1);
+    }
+    nkl=parselist(g,&g,kls,maxn);
+    if (*g==':') npr=parselist(g+1,&g,prs,2);
+    FILE *csv=stdout;
+    if (csvname && !(csv=fopen(csvname,"w"))) {
+        perror("fopen");
+        exit(1);
+    }
+    workerpool pool(defaultthreads());
+    std::vector<std::unique_ptr<attack<l>>> state(pool.size());
+    fprintf(stderr,"Sweeping %d cells of %d trials on %d threads (seed %llu)\n",
+        nivl*nkl*npr,niter,pool.size(),(unsigned long long)seed);
+    fprintf(csv,"ivs,keylen,printable,trials,words,ok,rate,ci_low,ci_high,seconds\n");
+    for (int a=0;a<nivl;a++) for (int b=0;b<nkl;b++) for (int c=0;c<npr;c++) {
+        int cnivs=ivs[a]<1?1:ivs[a]>L?L:ivs[a];
+        int ckeylen=kls[b]<1?1:kls[b]>L-IVlen?L-IVlen:kls[b];
+        bool cprint=prs[c] && l==8;
+        std::vector<long> nok(ckeylen,0);
+        padded<std::atomic<long>> next{0};
+        std::mutex mx;
+        const int chunk=16;
+        double t0=now();
+        pool.run([&](int id) {
+            if (!state[id]) state[id].reset(new attack<l>);
+            attack<l> &st=*state[id];
+            st.keylen=ckeylen;
+            st.nivs=cnivs;
+            st.onlyprintable=cprint;
+            std::vector<long> loc(ckeylen,0);
+            for (long t;(t=next.v.fetch_add(chunk))<niter;)
+                for (long e=std::min<long>(t+chunk,niter);t<e;t++)
+                    for (int ok=st.trial(t);ok>0;) loc[--ok]++;
+            std::lock_guard<std::mutex> lk(mx);
+            for (int i=0;i<ckeylen;i++) nok[i]+=loc[i];
+        });
+        double secs=now()-t0;
+        for (int i=0;i<ckeylen;i++) {
+            double lo,hi;
+            wilson(nok[i],niter,&lo,&hi);
+            fprintf(csv,"%d,%d,%d,%d,%d,%ld,%.6f,%.6f,%.6f,%.3f\n",cnivs,ckeylen,cprint,niter,i+1,nok[i],nok[i]/double(niter),lo,hi,secs);
         }
-        int fmax=0;
-        int fmaxind=0;
-        for (int i=0;i<L;i++)
-            if ((!onlyprintable || isprintable(i)) && freq[i]>fmax) {
-                fmax=freq[i];
-                fmaxind=i;
+        fflush(csv);
+        fprintf(stderr,"  ivs=%d keylen=%d printable=%d: %.2f%% full keys\n",cnivs,ckeylen,cprint,nok[ckeylen-1]*100.0/niter);
+    }
+    if (csv!=stdout) fclose(csv);
+}
+
+// Core scaling benchmark (-B).
+// Runs the same num_keys trials on pools of 1, 2, 4, ... threads up to the
+// -j count (default: all cores), and writes a CSV of the trials per second,
+// the speedup over one thread and the parallel efficiency. The per-thread
+// states are allocated (and first touched) by a warm-up job, and every thread
+// adds its correct words to its own padded counter. The trials do not depend
+// on the thread count, so the words column must be the same on every line.
+
+template<int l>
+void scaling(int niter) {
+    int maxth=defaultthreads();
+    FILE *csv=stdout;
+    if (csvname && !(csv=fopen(csvname,"w"))) {
+        perror("fopen");
+        exit(1);
+    }
+    fprintf(stderr,"Scaling benchmark: %d trials of keys of %d words on 1 to %d threads%s (seed %llu)\n",
+        niter,keylen,maxth,pinthreads?", pinned":"",(unsigned long long)seed);
+    fprintf(csv,"threads,trials,words,seconds,trials_per_s,speedup,efficiency\n");
+    double base=0;
+    for (int n=1;;n=std::min(2*n,maxth)) {
+        workerpool pool(n);
+        std::vector<std::unique_ptr<attack<l>>> state(n);
+        std::vector<padded<long>> words(n);
+        padded<std::atomic<long>> next{0};
+        const int chunk=16;
+        pool.run([&](int id) {state[id].reset(new attack<l>);});
+        double t0=now();
+        pool.run([&](int id) {
+            attack<l> &st=*state[id];
+            for (long t;(t=next.v.fetch_add(chunk))<niter;)
+                for (long e=std::min<long>(t+chunk,niter);t<e;t++) words[id].v+=st.trial(t);
+        });
+        double secs=now()-t0,rate=niter/secs;
+        long total=0;
+        for (auto &w:words) total+=w.v;
+        if (n==1) base=rate;
+        fprintf(csv,"%d,%d,%ld,%.3f,%.0f,%.2f,%.3f\n",n,niter,total,secs,rate,rate/base,rate/base/n);
+        fflush(csv);
+        if (n==maxth) break;
+    }
+    if (csv!=stdout) fclose(csv);
+}
+
+// Exact enumeration (small word sizes only).
+// Walks all the L^keylen keys and all the L magic IVs of every key word, and
+// counts exactly how often the first-word heuristic of guesskey() is right,
+// with the same weighted votes (IVs of weight 0 are skipped).
+// Keys are split into blocks sharing their first words, distributed among the
+// pool threads. Inside a block the remaining words are enumerated in
+// reflected L-ary Gray code order (the last key word changing fastest), so
+// consecutive keys differ in one word and the KSA is resumed from a saved
+// state just before the first step that uses the changed word.
+
+const int maxexactl=5;
+
+template<int l>
+struct exactblock {
+    static_assert(l<=maxexactl,"Exact enumeration of a large word size");
+    static const int L=RC4<l>::L;
+    static const int M=RC4<l>::M;
+    typedef typename RC4<l>::word word;
+
+    int keylen,hi,lo;          // Key length, fixed (block) and enumerated words
+    std::vector<uint16_t> cnt; // Scores per key of the block and candidate
+    std::vector<uint32_t> ok;  // Correctly guessed positions (bitmask) per key
+    std::vector<long> hits,right,prefix;
+    word ck[L][L];             // Saved state before the step using key word p
+    int ckJ[L];
+
+    exactblock(int kl,int h):keylen(kl),hi(h),lo(kl-h),hits(kl),right(kl),prefix(kl) {
+        long n=1;
+        for (int i=0;i<lo;i++) n*=L;
+        cnt.resize(n*L);
+        ok.resize(n);
+    }
+
+    // Run the KSA on seed from step t0 (with state S,J before it), saving the
+    // states before the steps that use later key words, and return the first
+    // keystream word.
+    int resume(int *seed,int seedlen,word *S,int J,int t0) {
+        for (int t=t0;t<L;t++) {
+            int p=t-3;
+            if (t>t0 && p>=hi && p<keylen) {
+                memcpy(ck[p],S,sizeof(ck[p]));
+                ckJ[p]=J;
+            }
+            J=(J+S[t]+seed[t%seedlen])&M;
+            word T=S[t];S[t]=S[J];S[J]=T;
+        }
+        PROF_COUNT(CNT_KSA,1);
+        J=S[1];
+        word T=S[1];S[1]=S[J];S[J]=T;
+        return S[(S[1]+S[J])&M];
+    }
+
+    static constexpr int maxweight() {
+        int m=0;
+        for (int i=0;i<L-3;i++) if (fmsweighttable<l>.w[i]>m) m=fmsweighttable<l>.w[i];
+        return m;
+    }
+
+    void run(long b) {
+        static_assert(L*maxweight()<65536,"Scores do not fit in cnt");
+        int seed[L];
+        int seedlen=keylen+3;
+        for (int i=hi-1;i>=0;i--,b/=L) seed[3+i]=b%L;
+        std::fill(ok.begin(),ok.end(),0);
+        for (int n=0;n<keylen;n++) {
+            std::fill(cnt.begin(),cnt.end(),0);
+            for (int x=0;x<L;x++) {
+                int wt=fmsweight<l>(n,x);
+                if (!wt) continue;
+                seed[0]=(n+3)&M;
+                seed[1]=(-1)&M;
+                seed[2]=x;
+                for (int i=hi;i<keylen;i++) seed[3+i]=0;
+                // State before the first enumerated word
+                word S[L];
+                int J=0;
+                for (int i=0;i<L;i++) S[i]=i;
+                for (int t=0;t<3+hi;t++) {
+                    J=(J+S[t]+seed[t%seedlen])&M;
+                    word T=S[t];S[t]=S[J];S[J]=T;
+                }
+                int p=hi;
+                memcpy(ck[p],S,sizeof(ck[p]));
+                ckJ[p]=J;
+                int dir[L];
+                for (int j=0;j<lo;j++) dir[j]=1;
+                for (;;) {
+                    word W[L];
+                    memcpy(W,ck[p],sizeof(W));
+                    int z=resume(seed,seedlen,W,ckJ[p],3+p);
+                    int ofs=3,idx=0;
+                    for (int m=0;m<=n;m++) ofs+=m+3;
+                    for (int m=0;m<n;m++) ofs+=seed[3+m];
+                    for (int m=hi;m<keylen;m++) idx=idx*L+seed[3+m];
+                    int v=(z-ofs-x)&M;
+                    cnt[long(idx)*L+v]+=wt;
+                    if (v==seed[3+n]) hits[n]++;
+                    // Next key in Gray order: digit j is key word keylen-1-j
+                    int j;
+                    for (j=0;j<lo;j++) {
+                        int d=seed[3+keylen-1-j]+dir[j];
+                        if (d>=0 && d<L) break;
+                        dir[j]=-dir[j];
+                    }
+                    if (j==lo) break;
+                    p=keylen-1-j;
+                    seed[3+p]+=dir[j];
+                }
             }
-        if (verbosity>0) printf("    Max freq %d detected at %02X (key[%d]=%02X)\n",fmax,fmaxind,n,key[n]);
-        gk[n]=fmaxind;
-        ofs+=fmaxind;
+            // guesskey() picks the first candidate with the largest score
+            for (long k=0;k<(long)ok.size();k++) {
+                const uint16_t *f=&cnt[k*L];
+                int fmax=0,fmaxind=0;
+                for (int i=0;i<L;i++) if (f[i]>fmax) {fmax=f[i];fmaxind=i;}
+                int kn;
+                if (n<hi) kn=seed[3+n];
+                else {
+                    long q=k;
+                    for (int m=keylen-1;m>n;m--) q/=L;
+                    kn=q%L;
+                }
+                if (fmaxind==kn) {
+                    ok[k]|=1u<<n;
+                    right[n]++;
+                }
+            }
+        }
+        for (long k=0;k<(long)ok.size();k++)
+            for (int n=0;n<keylen && (ok[k]>>n&1);n++) prefix[n]++;
+    }
+};
+
+template<int l>
+void exactrun() {
+    const int L=RC4<l>::L;
+    if (l*keylen>40) {
+        fprintf(stderr,"Too many keys to enumerate (at most 2^40)\n");
+        exit(1);
+    }
+    workerpool pool(defaultthreads());
+    // Fixed words: enough blocks for all threads, at most 2^16 keys per block
+    int hi=0;
+    long nblocks=1,nkeys=1;
+    for (int i=0;i<keylen;i++) nkeys*=L;
+    while (hi<keylen-1 && (nblocks<4L*pool.size() || nkeys/nblocks>65536)) {
+        hi++;
+        nblocks*=L;
+    }
+    printf("Enumerating %ld keys of %d words and %d magic IVs per key word (a word consists of %d bits)\n",nkeys,keylen,L,l);
+    std::vector<std::unique_ptr<exactblock<l>>> state(pool.size());
+    padded<std::atomic<long>> next{0};
+    double t0=now();
+    pool.run([&](int id) {
+        state[id].reset(new exactblock<l>(keylen,hi));
+        for (long b;(b=next.v.fetch_add(1))<nblocks;) state[id]->run(b);
+    });
+    std::vector<long> hits(keylen),right(keylen),prefix(keylen),nvotes(keylen);
+    for (int n=0;n<keylen;n++)
+        for (int x=0;x<L;x++) if (fmsweight<l>(n,x)) nvotes[n]++;
+    for (auto &st:state) if (st)
+        for (int n=0;n<keylen;n++) {
+            hits[n]+=st->hits[n];
+            right[n]+=st->right[n];
+            prefix[n]+=st->prefix[n];
+        }
+    printf("\nExact statistics (%.1f s):\n",now()-t0);
+    printf(" word   vote hit prob.   word guessed (prefix known)   first words guessed\n");
+    for (int n=0;n<keylen;n++)
+        printf("%c %3d   %.8f       %.8f (%ld/%ld)       %.8f (%ld/%ld)\n",n==keylen-3?'*':' ',n+1,
+            hits[n]/double(nkeys*nvotes[n]),right[n]/double(nkeys),right[n],nkeys,prefix[n]/double(nkeys),prefix[n],nkeys);
+}
+
+// exactblock<l> is only instantiated for the small word sizes (ck alone
+// would take 8 GB for l=16)
+
+template<int l>
+void exact() {
+    if constexpr (l<=maxexactl) exactrun<l>();
+    else {
+        fprintf(stderr,"Exact enumeration is only available for words of at most %d bits\n",maxexactl);
+        exit(1);
+    }
+}
+
+// Keystream bias analyser.
+// Every thread generates random keys of keylen words (without IV) and counts
+// the keystream words at the first npos positions, and the pairs of
+// consecutive words (digraphs) starting at the first ndig positions, in its
+// own histograms (allocated on separate cache lines, so no two threads write
+// to the same line). A cell grows at most by one per key, so a thread adds its
+// 32-bit cells into the 64-bit totals (and clears them) before they can wrap
+// around, and once more at the end. The totals are written as CSV with
+// the z-score of every count against the uniform distribution: all the
+// single word cells, and the digraph cells with |z|>=zmin.
+// E.g. for l=8 the second word is 0 twice as often as expected (Mantin and
+// Shamir) and the digraph (0,0) at the first positions is also biased
+// (Fluhrer and McGrew).
+
+const double zmin=4;
+
+template<int l>
+struct biascounter {
+    static const int L=RC4<l>::L;
+    int npos,ndig;
+    uint32_t nkeys;    // Keys counted since the last fold()
+    uint32_t *single;  // [npos][L]
+    uint32_t *dig;     // [ndig][L][L]
+    RC4<l> rc;
+    int key[L];
+
+    static uint32_t *alloc(size_t n) {
+        size_t bytes=(n*sizeof(uint32_t)+63)&~size_t(63);
+        void *p=aligned_alloc(64,bytes);
+        if (!p) {
+            fprintf(stderr,"Not enough memory for the histograms\n");
+            exit(1);
+        }
+        memset(p,0,bytes);
+        return (uint32_t *)p;
+    }
+    biascounter(int np,int nd):npos(np),ndig(nd),nkeys(0) {
+        single=alloc(size_t(npos)*L);
+        dig=alloc(std::max<size_t>(1,size_t(ndig)*L*L));
+    }
+    ~biascounter() {free(single);free(dig);}
+
+    void count(uint64_t t) {
+        rng r(seed,t);
+        for (int i=0;i<keylen;i++) key[i]=r.word()&RC4<l>::M;
+        rc.expandkey((int *)0,0,key,keylen);
+        rc.initperm();
+        PROF_COUNT(CNT_KSA,1);
+        int prev=0;
+        for (int p=0;p<npos;p++) {
+            int z=rc.genbyte();
+            single[size_t(p)*L+z]++;
+            if (p>0 && p<=ndig) dig[(size_t(p-1)*L+prev)*L+z]++;
+            prev=z;
+        }
+        nkeys++;
+    }
+
+    // Add the counts to the totals and clear them
+    void fold(std::vector<uint64_t> &tsingle,std::vector<uint64_t> &tdig) {
+        for (size_t i=0;i<tsingle.size();i++) tsingle[i]+=single[i];
+        for (size_t i=0;i<tdig.size();i++) tdig[i]+=dig[i];
+        memset(single,0,tsingle.size()*sizeof(uint32_t));
+        memset(dig,0,tdig.size()*sizeof(uint32_t));
+        nkeys=0;
+    }
+};
+
+double zscore(uint64_t k,uint64_t n,double p) {
+    return (k-n*p)/sqrt(n*p*(1-p));
+}
+
+template<int l>
+void analyse(long nkeys) {
+    const int L=RC4<l>::L;
+    int npos=256,ndig=-1;
+    if (sscanf(biasspec,"%d:%d",&npos,&ndig)<1 || npos<1) {
+        fprintf(stderr,"Badly formed bias spec (expected POSITIONS[:DIGRAPHS])\n");
+        exit(1);
+    }
+    if (ndig<0) ndig=std::min(npos-1,16);
+    if (ndig>npos-1) ndig=npos-1;
+    if (l>8) ndig=0;   // L*L counters per position would not fit
+    FILE *csv=stdout;
+    if (csvname && !(csv=fopen(csvname,"w"))) {
+        perror("fopen");
+        exit(1);
     }
+    workerpool pool(defaultthreads());
+    std::vector<std::unique_ptr<biascounter<l>>> state(pool.size());
+    fprintf(stderr,"Analysing %ld keys of %d words, %d positions and %d digraph positions on %d threads (seed %llu)\n",
+        nkeys,keylen,npos,ndig,pool.size(),(unsigned long long)seed);
+    padded<std::atomic<long>> next{0};
+    const int chunk=256;
+    std::vector<uint64_t> single(size_t(npos)*L),dig(size_t(ndig)*L*L);
+    std::mutex foldlock;
+    double t0=now();
+    pool.run([&](int id) {
+        state[id].reset(new biascounter<l>(npos,ndig));
+        biascounter<l> &st=*state[id];
+        for (long t;(t=next.v.fetch_add(chunk))<nkeys;) {
+            if (st.nkeys>UINT32_MAX-chunk) {
+                std::lock_guard<std::mutex> lk(foldlock);
+                st.fold(single,dig);
+            }
+            for (long e=std::min<long>(t+chunk,nkeys);t<e;t++) st.count(t);
+        }
+        std::lock_guard<std::mutex> lk(foldlock);
+        st.fold(single,dig);
+    });
+    double secs=now()-t0;
+    fprintf(csv,"kind,pos,a,b,count,prob,ratio,z\n");
+    double p1=1.0/L,p2=p1*p1;
+    double zbest=0;
+    int bpos=0,bval=0;
+    for (int p=0;p<npos;p++)
+        for (int a=0;a<L;a++) {
+            uint64_t k=single[size_t(p)*L+a];
+            double z=zscore(k,nkeys,p1);
+            fprintf(csv,"single,%d,%d,,%llu,%.9f,%.6f,%.3f\n",p+1,a,(unsigned long long)k,k/double(nkeys),k/(nkeys*p1),z);
+            if (fabs(z)>fabs(zbest)) {zbest=z;bpos=p+1;bval=a;}
+        }
+    long ndigout=0;
+    for (int p=0;p<ndig;p++)
+        for (int a=0;a<L;a++)
+            for (int b=0;b<L;b++) {
+                uint64_t k=dig[(size_t(p)*L+a)*L+b];
+                double z=zscore(k,nkeys,p2);
+                if (fabs(z)<zmin) continue;
+                fprintf(csv,"digraph,%d,%d,%d,%llu,%.9f,%.6f,%.3f\n",p+1,a,b,(unsigned long long)k,k/double(nkeys),k/(nkeys*p2),z);
+                ndigout++;
+            }
+    if (csv!=stdout) fclose(csv);
+    fprintf(stderr,"%.2f s, %.0f keys/s, %.0f keys/s/core\n",secs,nkeys/secs,nkeys/secs/pool.size());
+    fprintf(stderr,"Largest single word bias: position %d, word %d (z=%.1f); %ld digraph cells with |z|>=%.0f\n",
+        bpos,bval,zbest,ndigout,zmin);
+}
+
+// Time-memory tradeoff for short keys (rainbow tables), 8-bit words only.
+// With the IV fixed, f(k) = the first keylen keystream bytes of IV||k maps
+// every key to a keystream prefix of the same size. A chain starts at a key
+// k[0] and alternates f and the reduction of column i,
+//   k[i+1] = R_i(f(k[i])), with R_i(y) = (y+i*C) mod 2^(8*keylen),
+// for chainlen columns, and only its start and its end k[chainlen] are
+// stored, sorted by end. The lookup of the keystream prefix y of a record
+// with that IV tries every column c, from the last one: it completes the
+// chain from R_c(y) and searches the end in the table. On a match the chain
+// is rebuilt from its start, and its key at column c is a candidate when f of
+// it is y (otherwise the chain merely merged into the one of y). The first
+// candidate that explains all the records is the key.
+//
+// -R CHAINLEN[:IV] builds a table of num_keys chains for keys of key_length
+// bytes (at most 8) into the -o file, on all the pool threads. The file
+// (header and (start, end) pairs) is mapped in memory and sorted in place;
+// of the chains with the same end only one is kept. The coverage is
+// estimated from the distinct keys of every column of the chains generated,
+// m[i+1] = N(1-e^(-m[i]/N)), and measured by looking up random keys.
+// -K TABLE looks up the records (lines as in attack, with the keystream
+// bytes) read from the standard input.
+
+const char *rtspec=0;      // Chain length and IV of the table built (-R)
+const char *rtname=0;      // Table looked up (-K)
+const int rtsamples=100;   // Random keys looked up to measure the coverage
+
+struct rtheader {
+    char magic[4];     // "RC4R"
+    uint32_t keylen,chainlen;
+    uint8_t iv[4];
+    uint64_t nchains,seed;
+};
+
+struct rtchain {
+    uint64_t start,end;
+};
+
+struct rttable {
+    rtheader *h;
+    const rtchain *c;
+    size_t size;
+
+    uint64_t mask() const {return h->keylen<8?(uint64_t(1)<<8*h->keylen)-1:~uint64_t(0);}
+    uint64_t reduce(uint64_t y,int i) const {return (y+i*0x9E3779B97F4A7C15ULL)&mask();}
+
+    // f(k): keystream prefix of IV||k
+    uint64_t f(RC4<8> &rc,uint64_t k) const {
+        int iv[3]={h->iv[0],h->iv[1],h->iv[2]},key[8];
+        for (unsigned i=0;i<h->keylen;i++) key[i]=(k>>8*i)&0xFF;
+        rc.expandkey(iv,3,key,h->keylen);
+        rc.initperm();
+        PROF_COUNT(CNT_KSA,1);
+        uint64_t y=0;
+        for (unsigned i=0;i<h->keylen;i++) y|=uint64_t(rc.genbyte())<<8*i;
+        return y;
+    }
+
+    // Chain from key k at column c to the end
+    uint64_t walk(RC4<8> &rc,uint64_t k,int c) const {
+        for (int i=c;i<int(h->chainlen);i++) k=reduce(f(rc,k),i);
+        return k;
+    }
+
+    // A key k with f(k)=y that is accepted, if the table covers one
+    bool lookup(RC4<8> &rc,uint64_t y,uint64_t &k,const std::function<bool(uint64_t)> &accept) const {
+        const rtchain *end=c+h->nchains;
+        for (int col=h->chainlen-1;col>=0;col--) {
+            uint64_t e=walk(rc,reduce(y,col),col+1);
+            const rtchain *p=std::lower_bound(c,end,e,[](const rtchain &a,uint64_t v) {return a.end<v;});
+            if (p==end || p->end!=e) continue;
+            k=p->start;
+            for (int i=0;i<col;i++) k=reduce(f(rc,k),i);
+            if (f(rc,k)==y && accept(k)) return true;
+        }
+        return false;
+    }
+};
+
+// Estimated share of the N keys found in the table
+double rtcoverage(double m,int chainlen,double N) {
+    double miss=1;
+    for (int i=0;i<chainlen;i++) {
+        miss*=1-m/N;
+        m=N*(1-exp(-m/N));
+    }
+    return 1-miss;
+}
+
+void buildtable(int nchains) {
+    int chainlen=0;
+    unsigned iv[3]={0,0,0};
+    if (sscanf(rtspec,"%d:%2x%2x%2x",&chainlen,&iv[0],&iv[1],&iv[2])<1 || chainlen<1) {
+        fprintf(stderr,"Badly formed table spec (expected CHAINLEN[:IV], e.g. 1000:03FF07)\n");
+        exit(1);
+    }
+    if (keylen>8 || !csvname) {
+        fprintf(stderr,"Tables are for keys of at most 8 bytes, and need an output file (-o)\n");
+        exit(1);
+    }
+    size_t size=sizeof(rtheader)+size_t(nchains)*sizeof(rtchain);
+    int fd=open(csvname,O_RDWR|O_CREAT|O_TRUNC,0644);
+    if (fd<0 || ftruncate(fd,size)<0) {
+        perror(csvname);
+        exit(1);
+    }
+    void *map=mmap(0,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    if (map==MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    rttable tb;
+    tb.h=(rtheader *)map;
+    rtchain *chains=(rtchain *)(tb.h+1);
+    tb.c=chains;
+    memcpy(tb.h->magic,"RC4R",4);
+    tb.h->keylen=keylen;
+    tb.h->chainlen=chainlen;
+    for (int i=0;i<3;i++) tb.h->iv[i]=iv[i];
+    tb.h->nchains=nchains;
+    tb.h->seed=seed;
+    workerpool pool(defaultthreads());
+    fprintf(stderr,"Building %d chains of %d keys of %d bytes (IV %02X%02X%02X) on %d threads\n",
+        nchains,chainlen,keylen,iv[0],iv[1],iv[2],pool.size());
+    padded<std::atomic<long>> next{0};
+    const int chunk=64;
+    double t0=now();
+    pool.run([&](int id) {
+        std::unique_ptr<RC4<8>> rc(new RC4<8>);
+        for (long t;(t=next.v.fetch_add(chunk))<nchains;)
+            for (long e=std::min<long>(t+chunk,nchains);t<e;t++) {
+                chains[t].start=rng(seed,t).next()&tb.mask();
+                chains[t].end=tb.walk(*rc,chains[t].start,0);
+            }
+    });
+    double gensecs=now()-t0;
+    std::sort(chains,chains+nchains,[](const rtchain &a,const rtchain &b) {return a.end<b.end;});
+    tb.h->nchains=std::unique(chains,chains+nchains,[](const rtchain &a,const rtchain &b) {return a.end==b.end;})-chains;
+    double secs=now()-t0;
+    size=sizeof(rtheader)+tb.h->nchains*sizeof(rtchain);
+    // Coverage measured on random keys (other streams than the chain starts)
+    padded<std::atomic<long>> found{0};
+    next.v=0;
+    double t1=now();
+    pool.run([&](int id) {
+        std::unique_ptr<RC4<8>> rc(new RC4<8>);
+        for (long t;(t=next.v.fetch_add(1))<rtsamples;) {
+            uint64_t k,key=rng(~seed,t).next()&tb.mask();
+            if (tb.lookup(*rc,tb.f(*rc,key),k,[&](uint64_t c) {return c==key;})) found.v++;
+        }
+    });
+    double lsecs=(now()-t1)*pool.size()/rtsamples;
+    uint64_t n=tb.h->nchains;
+    munmap(map,sizeof(rtheader)+size_t(nchains)*sizeof(rtchain));
+    if (ftruncate(fd,size)<0 || close(fd)<0) {
+        perror(csvname);
+        exit(1);
+    }
+    double N=pow(2.0,8*keylen);
+    printf("Table %s: %llu chains (%d merged), %.1f MB\n",csvname,(unsigned long long)n,int(nchains-n),size/1e6);
+    printf("Generation: %.2f s (%.2f s of chains, %.0f keys/s)\n",secs,gensecs,double(nchains)*chainlen/gensecs);
+    printf("Coverage: %.2f%% estimated, %ld/%d random keys found (%.2f s per lookup)\n",
+        100*rtcoverage(nchains,chainlen,N),found.v.load(),rtsamples,lsecs);
+}
+
+void lookuptable() {
+    int fd=open(rtname,O_RDONLY);
+    struct stat sb;
+    if (fd<0 || fstat(fd,&sb)<0) {
+        perror(rtname);
+        exit(1);
+    }
+    void *map=mmap(0,sb.st_size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    rttable tb;
+    tb.h=(rtheader *)map;
+    tb.c=(const rtchain *)(tb.h+1);
+    if (map==MAP_FAILED || size_t(sb.st_size)<sizeof(rtheader) || memcmp(tb.h->magic,"RC4R",4) ||
+        size_t(sb.st_size)!=sizeof(rtheader)+tb.h->nchains*sizeof(rtchain) || tb.h->keylen<1 || tb.h->keylen>8) {
+        fprintf(stderr,"%s: not a table\n",rtname);
+        exit(1);
+    }
+    // Records: IV and keystream bytes
+    struct record {
+        unsigned char iv[RC4LAB_IVLEN],z[256];
+        int n;
+    };
+    std::vector<record> recs;
+    char line[1024];
+    record r;
+    while (fgets(line,sizeof(line),stdin))
+        if ((r.n=rc4lab_parse_record(line,r.iv,r.z,256))>0) recs.push_back(r);
+    RC4<8> rc;
+    rc4lab_ctx *ctx=rc4lab_new();
+    int ntried=0;
+    double t0=now();
+    for (const record &q:recs) {
+        if (memcmp(q.iv,tb.h->iv,3) || q.n<int(tb.h->keylen)) continue;
+        ntried++;
+        uint64_t k,y=0;
+        for (unsigned i=0;i<tb.h->keylen;i++) y|=uint64_t(q.z[i])<<8*i;
+        unsigned char key[8],z[256];
+        auto explains=[&](uint64_t c) {
+            for (unsigned i=0;i<tb.h->keylen;i++) key[i]=c>>8*i;
+            size_t ok=0;
+            for (const record &p:recs) {
+                rc4lab_setkey_iv(ctx,p.iv,RC4LAB_IVLEN,key,tb.h->keylen);
+                rc4lab_keystream(ctx,z,p.n);
+                ok+=!memcmp(z,p.z,p.n);
+            }
+            if (verbosity>0 && ok<recs.size()) printf("Candidate explains %zu of %zu records\n",ok,recs.size());
+            return ok==recs.size();
+        };
+        if (!tb.lookup(rc,y,k,explains)) continue;
+        printf("Key: ");
+        for (unsigned i=0;i<tb.h->keylen;i++) printf("%02X",key[i]);
+        printf(" (%d lookups, %.2f s)\n",ntried,now()-t0);
+        exit(0);
+    }
+    printf("Key not found (%d of %zu records with IV %02X%02X%02X looked up, %.2f s)\n",
+        ntried,recs.size(),tb.h->iv[0],tb.h->iv[1],tb.h->iv[2],now()-t0);
+    exit(1);
+}
+
+// Distributed Monte Carlo.
+// The coordinator (-C ADDR) splits the niter trials into ranges of trial
+// numbers and hands them out to the workers (-W ADDR) connected to it. Every
+// worker runs its ranges on its own thread pool and returns the nok[]
+// counters. Since each trial draws from its own random stream (see rng), the
+// merged counters are the same as those of a single process with the same
+// seed. Ranges of workers that disconnect before returning them are handed
+// out again, and so are the ranges not returned before their deadline
+// (rangetimeout, or 10 times the longest range so far) in case the worker
+// hangs; the first result of a range is kept. With -F the coordinator stops
+// when all its worker processes have exited and no worker is connected.
+// ADDR is host:port (TCP) or the path of a Unix socket: unix:PATH,
+// or a path starting with / or . or without any ':'. -F N starts N local
+// worker processes as a single-host stand-in.
+//
+// Protocol (text lines):
+//   coordinator: JOB l keylen nivs printable seed, then RANGE t0 t1 or DONE
+//   worker:      RESULT t0 t1 seconds nok[0] .. nok[keylen-1]
+// and the coordinator answers every RESULT with the next RANGE (or DONE).
+
+// Path of the Unix socket of addr, NULL for TCP
+const char *unixpath(const char *addr) {
+    if (!strncmp(addr,"unix:",5)) return addr+5;
+    if (addr[0]=='/' || addr[0]=='.' || !strchr(addr,':')) return addr;
+    return NULL;
+}
+
+int netsocket(const char *addr,bool listening) {
+    const char *colon=strrchr(addr,':');
+    int fd;
+    if (const char *path=unixpath(addr)) {
+        addr=path;
+        struct sockaddr_un sa;
+        memset(&sa,0,sizeof(sa));
+        sa.sun_family=AF_UNIX;
+        if (strlen(addr)>=sizeof(sa.sun_path)) {
+            fprintf(stderr,"Socket path too long: %s\n",addr);
+            exit(1);
+        }
+        strcpy(sa.sun_path,addr);
+        if ((fd=socket(AF_UNIX,SOCK_STREAM,0))<0) return -1;
+        if (listening) unlink(addr);
+        if ((listening?bind(fd,(struct sockaddr *)&sa,sizeof(sa)):connect(fd,(struct sockaddr *)&sa,sizeof(sa)))<0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        std::string host(addr,colon-addr);
+        struct addrinfo hints,*ai;
+        memset(&hints,0,sizeof(hints));
+        hints.ai_socktype=SOCK_STREAM;
+        hints.ai_flags=listening?AI_PASSIVE:0;
+        if (getaddrinfo(host.empty()?NULL:host.c_str(),colon+1,&hints,&ai)) {
+            fprintf(stderr,"Unknown address: %s\n",addr);
+            exit(1);
+        }
+        if ((fd=socket(ai->ai_family,SOCK_STREAM,0))<0) {
+            freeaddrinfo(ai);
+            return -1;
+        }
+        int one=1;
+        setsockopt(fd,SOL_SOCKET,listening?SO_REUSEADDR:SO_KEEPALIVE,&one,sizeof(one));
+        int r=listening?bind(fd,ai->ai_addr,ai->ai_addrlen):connect(fd,ai->ai_addr,ai->ai_addrlen);
+        freeaddrinfo(ai);
+        if (r<0) {
+            close(fd);
+            return -1;
+        }
+    }
+    if (listening && listen(fd,64)<0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool sendline(int fd,const std::string &line) {
+    std::string m=line+"\n";
+    for (size_t n=0;n<m.size();) {
+        ssize_t r=send(fd,m.data()+n,m.size()-n,MSG_NOSIGNAL);
+        if (r<0 && errno==EINTR) continue;
+        if (r<=0) return false;
+        n+=r;
+    }
+    return true;
+}
+
+// Reads a line (without the newline) through the buffer buf; false at the
+// end of the connection.
+bool recvline(int fd,std::string &buf,std::string &line) {
+    size_t e;
+    while ((e=buf.find('\n'))==std::string::npos) {
+        char tmp[4096];
+        ssize_t r=recv(fd,tmp,sizeof(tmp),0);
+        if (r<0 && errno==EINTR) continue;
+        if (r<=0) return false;
+        buf.append(tmp,r);
+    }
+    line=buf.substr(0,e);
+    buf.erase(0,e+1);
+    return true;
+}
+
+// Worker side: runs the ranges it receives until DONE.
+
+template<int l>
+void serve() {
+    workerpool pool(defaultthreads());
+    std::vector<std::unique_ptr<attack<l>>> state(pool.size());
+    std::string line;
+    long t0,t1;
+    while (recvline(workerfd,workerbuf,line) && sscanf(line.c_str(),"RANGE %ld %ld",&t0,&t1)==2) {
+        std::vector<long> nok(keylen,0);
+        padded<std::atomic<long>> next{t0};
+        std::mutex mx;
+        const int chunk=16;
+        double start=now();
+        pool.run([&](int id) {
+            if (!state[id]) state[id].reset(new attack<l>);
+            attack<l> &st=*state[id];
+            std::vector<long> loc(keylen,0);
+            for (long t;(t=next.v.fetch_add(chunk))<t1;)
+                for (long e=std::min<long>(t+chunk,t1);t<e;t++)
+                    for (int ok=st.trial(t);ok>0;) loc[--ok]++;
+            std::lock_guard<std::mutex> lk(mx);
+            for (int i=0;i<keylen;i++) nok[i]+=loc[i];
+        });
+        char res[64];
+        snprintf(res,sizeof(res),"RESULT %ld %ld %.6f",t0,t1,now()-start);
+        std::string msg(res);
+        for (int i=0;i<keylen;i++) msg+=" "+std::to_string(nok[i]);
+        if (!sendline(workerfd,msg)) break;
+    }
+    close(workerfd);
+}
+
+void worker();
+
+// Coordinator side. Results are stored per range and added up in range
+// order once all have arrived.
+
+void printstats(const long *nok,int niter);
+
+const double rangetimeout=60;  // Minimum deadline of a range (s)
+
+template<int l>
+void coordinate(int niter) {
+    int lfd=netsocket(coordaddr,true);
+    if (lfd<0) {
+        perror(coordaddr);
+        exit(1);
+    }
+    std::vector<pid_t> kids;
+    for (int i=0;i<nforks;i++) {
+        pid_t pid=fork();
+        if (pid<0) {
+            perror("fork");
+            exit(1);
+        }
+        if (!pid) {
+            close(lfd);
+            workeraddr=coordaddr;
+            if (!nthreads) nthreads=1;
+            worker();
+            exit(0);
+        }
+        kids.push_back(pid);
+    }
+    const long batch=std::max(16,niter/256);
+    struct range {long t0,t1;bool done;std::vector<long> nok;};
+    std::vector<range> ranges;
+    for (long t=0;t<niter;t+=batch) ranges.push_back({t,std::min<long>(t+batch,niter),false,{}});
+    std::vector<int> pending;  // Ranges not assigned to any worker
+    for (int i=ranges.size()-1;i>=0;i--) pending.push_back(i);
+    struct client {int fd;int range;std::string buf;double assigned;bool requeued;};
+    std::vector<client> clients;
+    size_t ndone=0;
+    int nworkers=0,nlost=0;
+    double busy=0,start=now(),longest=0;
+    char job[128];
+    snprintf(job,sizeof(job),"JOB %d %d %d %d %llu",l,keylen,nivs,int(onlyprintable),(unsigned long long)seed);
+    fprintf(stderr,"Coordinating %d trials in %zu ranges at %s (seed %llu)\n",niter,ranges.size(),coordaddr,(unsigned long long)seed);
+    // Gives c the next pending range; idle workers (range -2) wait for one
+    auto assign=[&](client &c) {
+        while (!pending.empty() && ranges[pending.back()].done) pending.pop_back();
+        if (pending.empty()) {
+            c.range=-2;
+            return true;
+        }
+        c.range=pending.back();
+        c.assigned=now();
+        c.requeued=false;
+        pending.pop_back();
+        return sendline(c.fd,"RANGE "+std::to_string(ranges[c.range].t0)+" "+std::to_string(ranges[c.range].t1));
+    };
+    auto drop=[&](size_t i) {
+        if (clients[i].range>=0 && !clients[i].requeued && !ranges[clients[i].range].done) {
+            pending.push_back(clients[i].range);
+            nlost++;
+        }
+        close(clients[i].fd);
+        clients.erase(clients.begin()+i);
+    };
+    while (ndone<ranges.size()) {
+        std::vector<struct pollfd> pfd(clients.size()+1);
+        pfd[0]={lfd,POLLIN,0};
+        for (size_t i=0;i<clients.size();i++) pfd[i+1]={clients[i].fd,POLLIN,0};
+        int np=poll(pfd.data(),pfd.size(),1000);
+        if (np<0) {
+            if (errno==EINTR) continue;
+            perror("poll");
+            exit(1);
+        }
+        for (size_t i=kids.size();i-->0;) {
+            int status;
+            if (waitpid(kids[i],&status,WNOHANG)!=kids[i]) continue;
+            if (!WIFEXITED(status) || WEXITSTATUS(status))
+                fprintf(stderr,"Worker process %d failed (%s %d)\n",int(kids[i]),
+                    WIFSIGNALED(status)?"signal":"status",WIFSIGNALED(status)?WTERMSIG(status):WEXITSTATUS(status));
+            kids.erase(kids.begin()+i);
+        }
+        if (nforks && kids.empty() && clients.empty() && !np) {
+            fprintf(stderr,"All the worker processes exited with %zu of %zu ranges done\n",ndone,ranges.size());
+            exit(1);
+        }
+        double deadline=std::max(rangetimeout,10*longest);
+        for (auto &c:clients)
+            if (c.range>=0 && !c.requeued && now()-c.assigned>deadline) {
+                fprintf(stderr,"Trials %ld-%ld not returned after %.0f s, handed out again\n",
+                    ranges[c.range].t0,ranges[c.range].t1,now()-c.assigned);
+                pending.push_back(c.range);
+                c.requeued=true;
+                nlost++;
+            }
+        for (size_t i=clients.size();i-->0;) {
+            if (!pfd[i+1].revents) continue;
+            client &c=clients[i];
+            char tmp[4096];
+            ssize_t r=recv(c.fd,tmp,sizeof(tmp),0);
+            if (r<=0) {
+                if (r<0 && errno==EINTR) continue;
+                drop(i);
+                continue;
+            }
+            c.buf.append(tmp,r);
+            size_t e;
+            bool ok=true;
+            while (ok && (e=c.buf.find('\n'))!=std::string::npos) {
+                std::string line=c.buf.substr(0,e);
+                c.buf.erase(0,e+1);
+                long t0,t1;
+                double secs;
+                int n=0;
+                ok=c.range>=0 && sscanf(line.c_str(),"RESULT %ld %ld %lf%n",&t0,&t1,&secs,&n)==3 && n>0 &&
+                    t0==ranges[c.range].t0 && t1==ranges[c.range].t1;
+                std::vector<long> nok(keylen);
+                const char *p=ok?line.c_str()+n:NULL;
+                for (int k=0;ok && k<keylen;k++) {
+                    char *q;
+                    nok[k]=strtol(p,&q,10);
+                    ok=q!=p;
+                    p=q;
+                }
+                if (!ok) break;
+                range &rg=ranges[c.range];
+                if (!rg.done) {
+                    rg.done=true;
+                    rg.nok=nok;
+                    ndone++;
+                    busy+=secs;
+                    longest=std::max(longest,now()-c.assigned);
+                }
+                ok=assign(c);
+            }
+            if (!ok) drop(i);
+        }
+        // Ranges given back by lost workers go to the idle ones
+        for (size_t i=clients.size();i-->0 && !pending.empty();)
+            if (clients[i].range==-2 && !assign(clients[i])) drop(i);
+        if (pfd[0].revents & POLLIN) {
+            int fd=accept(lfd,NULL,NULL);
+            if (fd>=0) {
+                clients.push_back({fd,-1,"",0,false});
+                nworkers++;
+                if (!sendline(fd,job) || !assign(clients.back())) drop(clients.size()-1);
+            }
+        }
+    }
+    for (auto &c:clients) {
+        sendline(c.fd,"DONE");
+        close(c.fd);
+    }
+    close(lfd);
+    if (unixpath(coordaddr)) unlink(unixpath(coordaddr));
+    // Worker processes that do not exit after DONE (hung) are killed
+    for (double end=now();!kids.empty();usleep(10000)) {
+        for (size_t i=kids.size();i-->0;)
+            if (waitpid(kids[i],NULL,WNOHANG)==kids[i]) kids.erase(kids.begin()+i);
+        if (!kids.empty() && now()-end>5)
+            for (pid_t pid:kids) {
+                fprintf(stderr,"Killing worker process %d\n",int(pid));
+                kill(pid,SIGKILL);
+            }
+    }
+    std::vector<long> nok(keylen,0);
+    for (auto &rg:ranges)
+        for (int k=0;k<keylen;k++) nok[k]+=rg.nok[k];
+    double secs=now()-start;
+    printf("Tried %d random long-term %skeys of length %d words (a word consists of %d bits)\n",niter,onlyprintable?"printable ":"",keylen,l);
+    printf("%d workers, %d ranges reassigned, %.2f s (%.2f s of worker time, %.0f keys/s)\n",nworkers,nlost,secs,busy,niter/secs);
+    printstats(nok.data(),niter);
 }
 
 // Test a number of randomly generated keys.
@@ -275,22 +1342,155 @@ void guesskey() {
 // Default number of keys is 1. Default length is 5.
 // The IV length is fixed to 3 words, and it is always prepended to the long-term key.
 
-void processoption(const char *opt) {
+template<int l>
+int run(long nkeys) {
+    const int L=RC4<l>::L;
+    int niter=nkeys;
+    if (keylen>L-IVlen) keylen=L-IVlen;
+    if (workerfd>=0) {
+        serve<l>();
+        return 0;
+    }
+    if (rtspec || rtname) {
+        if (l!=8) {
+            fprintf(stderr,"Tables are only available for 8-bit words\n");
+            exit(1);
+        }
+        if (rtname) lookuptable();
+        else buildtable(niter);
+        return 0;
+    }
+    if (scalingbench) {
+        scaling<l>(niter);
+        return 0;
+    }
+    if (sweepgrid) {
+        sweep<l>(niter);
+        return 0;
+    }
+    if (onlyexact) {
+        exact<l>();
+        return 0;
+    }
+    if (biasspec) {
+        analyse<l>(nkeys);
+        return 0;
+    }
+    if (coordaddr) {
+        coordinate<l>(niter);
+        return 0;
+    }
+    printf("Trying %d random long-term %skeys of length %d words (a word consists of %d bits)\n",niter,onlyprintable?"printable ":"",keylen,l);
+    std::unique_ptr<attack<l>> st(new attack<l>);
+    long nok[keylen];
+    for (int i=0;i<keylen;i++) nok[i]=0;
+    for (int i=0;i<niter;i++) {
+        int ok=st->trial(i);
+        for (int j=0;j<ok;j++) nok[j]++;
+        printf("%c",ok>keylen-3?'X':'-'); // mark all attempts that retrieve at least the first keylen-2 key words
+        fflush(stdout);
+    }
+    printstats(nok,niter);
+    return 0;
+}
+
+// Some statistics
+
+void printstats(const long *nok,int niter) {
+    long totw=0;
+    int maxw;
+    for (maxw=0;maxw<keylen && nok[maxw]>0;maxw++) totw+=nok[maxw];
+    printf("\n\nStatistics:\n");
+    for (int i=0;i<maxw;i++) printf("%c %5.2f%% of the first %d key words correctly guessed\n",i==keylen-3?'*':' ',nok[i]/double(niter)*100,i+1);
+    printf("\nAverage length of the guessed key prefix: %.1f out of %d words\n",totw/double(niter),keylen);
+}
+
+// Prebuilt instantiations, selected with -w
+
+int (*const runners[maxl+1])(long)={0,0,0,0,
+    run<4>,run<5>,run<6>,run<7>,run<8>,run<9>,run<10>,run<11>,run<12>,
+    run<13>,run<14>,run<15>,run<16>};
+
+// Worker mode (-W): connects to the coordinator and runs its job.
+
+void worker() {
+    for (int tries=0;(workerfd=netsocket(workeraddr,false))<0;tries++) {
+        // The coordinator may still be starting
+        if (tries==50) {
+            perror(workeraddr);
+            exit(1);
+        }
+        usleep(100000);
+    }
+    std::string line;
+    int l,pr;
+    unsigned long long sd;
+    if (!recvline(workerfd,workerbuf,line) ||
+        sscanf(line.c_str(),"JOB %d %d %d %d %llu",&l,&keylen,&nivs,&pr,&sd)!=5 || l<minl || l>maxl) {
+        fprintf(stderr,"Bad job from the coordinator\n");
+        exit(1);
+    }
+    wordbits=l;
+    onlyprintable=pr;
+    seed=sd;
+    runners[wordbits](0);
+}
+
+// Options taking a value consume the next argument (returns 1 if it did).
+
+int processoption(const char *opt,const char *arg) {
+    bool consumearg=false;
+    const char **target=0;
     for (;;) {
         switch (*opt++) {
-            case 'p': if (l==8) onlyprintable=true;
+            case 'G': target=&sweepgrid;
+            break;
+            case 'o': target=&csvname;
+            break;
+            case 'A': target=&biasspec;
+            break;
+            case 'C': target=&coordaddr;
+            break;
+            case 'W': target=&workeraddr;
+            break;
+            case 'R': target=&rtspec;
+            break;
+            case 'K': target=&rtname;
+            break;
+            case 'j': case 'r': case 'w': case 'F':
+                if (consumearg || !arg) break;
+                consumearg=true;
+                if (opt[-1]=='j') nthreads=strtol(arg,NULL,0);
+                else if (opt[-1]=='F') nforks=strtol(arg,NULL,0);
+                else if (opt[-1]=='w') wordbits=strtol(arg,NULL,0);
+                else seed=strtoull(arg,NULL,0);
+            continue;
+            case 'p': onlyprintable=true;
             continue;
             case 'v': verbosity++;
             continue;
+            case 'E': onlyexact=true;
+            continue;
+            case 'a': pinthreads=true;
+            continue;
+            case 'B': scalingbench=true;
+            continue;
             case 't': onlytest=true;
             continue;
             case 'h': onlyhelp=true;
             continue; 
-            case 0: return;
+            case 0: return consumearg?1:0;
+        }
+        if (target && !consumearg && arg) {
+            consumearg=true;
+            *target=arg;
+            target=0;
+            continue;
         }
         break;
     }
-    fprintf(stderr,"Unknown option '-%c'\nThe only valid options are -p -v -t -h.\n",opt[-1]);
+    if (strchr("GoACWRKjrwF",opt[-1])) fprintf(stderr,"Option '-%c' needs an argument (only one such option per string)\n",opt[-1]);
+    else fprintf(stderr,"Unknown option '-%c'\nThe only valid options are -p -v -t -h -w -E -G -A -B -R -K -o -C -W -F -j -a -r.\n",opt[-1]);
     exit(1);
 }
 
@@ -300,46 +1500,66 @@ void givehelp(const char* appname=0) {
     fprintf(stderr,"num_keys is the number of attacked randomly generated keys (default: 1)\n");
     fprintf(stderr,"key_length is the length of the keys in bytes (default: 5)\n");
     fprintf(stderr,"Valid options:\n");
-    fprintf(stderr,"  -p: Use only printable (alphanumeric) bytes in the keys\n");
+    fprintf(stderr,"  -p: Use only printable (alphanumeric) bytes in the keys (only for 8-bit words)\n");
+    fprintf(stderr,"  -w <BITS>: Word size of the attacked RC4 variant, %d to %d bits (default: 8)\n",minl,maxl);
     fprintf(stderr,"  -v: Be more verbous\n");
     fprintf(stderr,"  -t: Generate test vectors (to check the implementation of RC4)\n");
     fprintf(stderr,"  -h: Print this help text\n");
+    fprintf(stderr,"  -E: Exact mode. Enumerate all keys of key_length words and all magic IVs and report the\n");
+    fprintf(stderr,"      exact success probabilities (only for words of at most %d bits, e.g. -E -w 4 1 3)\n",maxexactl);
+    fprintf(stderr,"  -G <GRID>: Sweep mode. Run num_keys trials for every cell of the grid IVS:KEYLENS[:PRINTABLE]\n");
+    fprintf(stderr,"             and write a CSV of success rates (e.g. -G 32,64,256:5,13:0,1)\n");
+    fprintf(stderr,"  -A <POS>[:<DIG>]: Bias analyser. Count the first POS keystream words and the digraphs at the\n");
+    fprintf(stderr,"             first DIG positions (default: 16) of num_keys random keys, and write a CSV of the\n");
+    fprintf(stderr,"             biases with z-scores (e.g. -A 256 1e8 16)\n");
+    fprintf(stderr,"  -B: Scaling benchmark. Run num_keys trials on 1, 2, 4, ... threads up to -j and write a CSV\n");
+    fprintf(stderr,"      of the trials per second and the speedup (e.g. -B -a 1e5 13)\n");
+    fprintf(stderr,"  -R <LEN>[:<IV>]: Build a time-memory tradeoff table of num_keys chains of LEN keys of\n");
+    fprintf(stderr,"             key_length bytes (at most 8) for the IV (default: 000000) into the -o file\n");
+    fprintf(stderr,"             (e.g. -R 1000:03FF07 -o t.rt 1e6 4)\n");
+    fprintf(stderr,"  -K <TABLE>: Recover the key of the records (0XIIIIII 0XKEYSTREAM lines) read from stdin\n");
+    fprintf(stderr,"             with the table\n");
+    fprintf(stderr,"  -o <FILE>: Write the sweep, bias or benchmark CSV (or the table) to <FILE> (default: stdout)\n");
+    fprintf(stderr,"  -C <ADDR>: Coordinator mode. Hand out the num_keys trials to the workers connecting to ADDR\n");
+    fprintf(stderr,"             (host:port, or unix:PATH or a path starting with / for a Unix socket) and merge\n");
+    fprintf(stderr,"             their statistics\n");
+    fprintf(stderr,"  -W <ADDR>: Worker mode. Run the trials handed out by the coordinator at ADDR\n");
+    fprintf(stderr,"  -F <N>: Start N local worker processes for the coordinator (one thread each unless -j)\n");
+    fprintf(stderr,"  -j <N>: Number of worker threads (default: all cores)\n");
+    fprintf(stderr,"  -a: Pin the worker threads to CPUs (thread i to the i-th allowed CPU)\n");
+    fprintf(stderr,"  -r <SEED>: Random seed (default: current time)\n");
 }
 
 int main(int argc, char *argv[]) {
-    srand(time(NULL));
+    PROF_INIT(phasenames,NPHASES,counternames,NCOUNTERS);
+    seed=time(NULL);
     int basearg;
-    for (basearg=0;basearg<argc-1 && argv[basearg+1][0]=='-';basearg++) processoption(argv[basearg+1]+1);
-    int niter=argc>basearg+1?strtod(argv[basearg+1],NULL):1;
-    if (niter<1) niter=1;
+    for (basearg=0;basearg<argc-1 && argv[basearg+1][0]=='-';basearg++) basearg+=processoption(argv[basearg+1]+1,argv[basearg+2]);
+    // Up to 2^62 keys for the bias analyser, INT_MAX trials otherwise
+    double n=argc>basearg+1?strtod(argv[basearg+1],NULL):1;
+    if (!(n<=(biasspec?0x1p62:INT_MAX))) {
+        fprintf(stderr,"Number of keys out of range (at most %.0f)\n",biasspec?0x1p62:INT_MAX);
+        exit(1);
+    }
+    long niter=n<1?1:n;
     keylen=argc>basearg+2?strtod(argv[basearg+2],NULL):5;
     if (keylen<1) keylen=1;
-    if (keylen>L-IVlen) keylen=L-IVlen;
     if (onlyhelp) {
         givehelp(argv[0]);
         exit(0);
     }
     if (onlytest) {
-        testvectors();
+        rc4lab_testvectors(stdout);
         exit(0);
     }
-    printf("Trying %d random long-term %skeys of length %d words (a word consists of %d bits)\n",niter,onlyprintable?"printable ":"",keylen,l);
-    int nok[keylen];
-    for (int i=0;i<keylen;i++) nok[i]=0;
-    for (int i=0;i<niter;i++) {
-        int ok=0;
-        if (onlyprintable) randpkey(); else randkey();
-        guesskey();
-        for (ok=0;ok<keylen && key[ok]==gk[ok];nok[ok++]++);
-        printf("%c",ok>keylen-3?'X':'-'); // mark all attempts that retrieve at least the first keylen-2 key words
-        fflush(stdout);
+    if (wordbits<minl || wordbits>maxl) {
+        fprintf(stderr,"Word size must be between %d and %d bits\n",minl,maxl);
+        exit(1);
     }
-    // Some statistics
-    int totw=0;
-    int maxw;
-    for (maxw=0;maxw<keylen && nok[maxw]>0;maxw++) totw+=nok[maxw];
-    printf("\n\nStatistics:\n");
-    for (int i=0;i<maxw;i++) printf("%c %5.2f%% of the first %d key words correctly guessed\n",i==keylen-3?'*':' ',nok[i]/double(niter)*100,i+1);
-    printf("\nAverage length of the guessed key prefix: %.1f out of %d words\n",totw/double(niter),keylen);
-    return 0;
+    if (workeraddr) {
+        worker();
+        exit(0);
+    }
+    if (wordbits!=8) onlyprintable=false;
+    return runners[wordbits](niter);
 }
@@ -0,0 +1,326 @@
+/*! librc4lab: capture readers.
+ *
+ * pcap and pcapng files of 802.11 traffic are mapped in memory and walked
+ * with a cursor, without copying the packets. Only WEP protected data frames
+ * are returned. Pages behind the cursor are released periodically, so the
+ * resident memory does not grow with the size of the capture.
+ *
+ * Compressed captures are read through a stream (rc4stream.c) instead. Packets
+ * are then returned in place inside the decompressed chunks, and only those
+ * straddling two chunks are copied to a scratch buffer.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rc4lab.h"
+
+#define DROP_STEP (64u << 20)   /* Release mapped pages every 64 MB */
+
+#define LINKTYPE_IEEE802_11        105
+#define LINKTYPE_IEEE802_11_PRISM  119
+#define LINKTYPE_IEEE802_11_RADIOTAP 127
+#define LINKTYPE_IEEE802_11_AVS    163
+
+#define MAXIF 16
+
+struct rc4lab_pcap {
+    const unsigned char *base;  /* Mapped file */
+    size_t size;
+    size_t pos;                 /* Cursor (bytes consumed) */
+    size_t dropped;             /* Released up to here */
+    rc4lab_stream *st;          /* Compressed captures */
+    const unsigned char *chunk; /* Current chunk and cursor in it */
+    size_t clen, coff;
+    unsigned char *sc;          /* Scratch: data at the cursor, before chunk+coff */
+    size_t scn, scsize;
+    int ng;                     /* pcapng */
+    int swap;                   /* Byte order differs from the host */
+    int linktype[MAXIF];        /* Per interface (only [0] for pcap) */
+    int nif;
+};
+
+static uint16_t rd16(const rc4lab_pcap *pc, const unsigned char *p) {
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return pc->swap ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t rd32(const rc4lab_pcap *pc, const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return pc->swap ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t le16(const unsigned char *p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t le32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t be32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/* Returns n contiguous bytes at the cursor, NULL if the capture ends before */
+static const unsigned char *need(rc4lab_pcap *pc, size_t n) {
+    if (!pc->st) return n <= pc->size - pc->pos ? pc->base + pc->pos : NULL;
+    if (!pc->scn && n <= pc->clen - pc->coff) return pc->chunk + pc->coff;
+    if (n > pc->scsize) {
+        size_t sz = pc->scsize ? pc->scsize : 4096;
+        while (sz < n) sz *= 2;
+        unsigned char *sc = realloc(pc->sc, sz);
+        if (!sc) return NULL;
+        pc->sc = sc;
+        pc->scsize = sz;
+    }
+    while (pc->scn < n) {
+        if (pc->coff == pc->clen) {
+            if (!(pc->chunk = rc4lab_stream_chunk(pc->st, &pc->clen))) {
+                pc->clen = pc->coff = 0;
+                return NULL;
+            }
+            pc->coff = 0;
+        }
+        size_t k = pc->clen - pc->coff;
+        if (k > n - pc->scn) k = n - pc->scn;
+        memcpy(pc->sc + pc->scn, pc->chunk + pc->coff, k);
+        pc->scn += k;
+        pc->coff += k;
+    }
+    return pc->sc;
+}
+
+/* Consumes n bytes (already obtained with need()) */
+static void skip(rc4lab_pcap *pc, size_t n) {
+    pc->pos += n;
+    if (!pc->st) return;
+    if (pc->scn) {
+        pc->scn -= n;
+        memmove(pc->sc, pc->sc + n, pc->scn);
+    } else pc->coff += n;
+}
+
+static void setup(rc4lab_pcap *pc, const unsigned char *hdr) {
+    uint32_t magic = le32(hdr);
+    if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d) pc->swap = 0;
+    else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1) pc->swap = 1;
+    else if (magic == 0x0a0d0d0a) pc->ng = 1;
+    else {
+        pc->ng = -1;
+        return;
+    }
+    if (!pc->ng) {
+        pc->linktype[0] = rd32(pc, hdr + 20) & 0xFFFF;
+        pc->nif = 1;
+        skip(pc, 24);
+    }
+}
+
+static rc4lab_pcap *open_stream(const char *path) {
+    rc4lab_pcap *pc = calloc(1, sizeof(rc4lab_pcap));
+    if (!pc) return NULL;
+    if (!(pc->st = rc4lab_stream_open(path))) {
+        free(pc);
+        return NULL;
+    }
+    const unsigned char *hdr = need(pc, 24);
+    if (hdr) setup(pc, hdr);
+    if (!hdr || pc->ng < 0) {
+        rc4lab_pcap_close(pc);
+        errno = EINVAL;
+        return NULL;
+    }
+    return pc;
+}
+
+rc4lab_pcap *rc4lab_pcap_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    unsigned char m[4];
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size < 24 || read(fd, m, 4) != 4) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((m[0] == 0x1f && m[1] == 0x8b) || (m[0] == 0x28 && m[1] == 0xb5 && m[2] == 0x2f && m[3] == 0xfd)) {
+        close(fd);
+        return open_stream(path);
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+    rc4lab_pcap *pc = calloc(1, sizeof(rc4lab_pcap));
+    if (!pc) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    pc->base = base;
+    pc->size = st.st_size;
+    setup(pc, pc->base);
+    if (pc->ng < 0) {
+        rc4lab_pcap_close(pc);
+        errno = EINVAL;
+        return NULL;
+    }
+    return pc;
+}
+
+void rc4lab_pcap_close(rc4lab_pcap *pc) {
+    if (!pc) return;
+    if (pc->st) rc4lab_stream_close(pc->st);
+    else munmap((void *)pc->base, pc->size);
+    free(pc->sc);
+    free(pc);
+}
+
+size_t rc4lab_pcap_offset(const rc4lab_pcap *pc) {
+    return pc->pos;
+}
+
+/* Offset of the radiotap Flags field, or -1 if absent */
+static int radiotap_flags(const unsigned char *p, size_t len) {
+    size_t off = 4;
+    uint32_t present;
+    do {
+        if (off + 4 > len) return -1;
+        present = le32(p + off);
+        off += 4;
+    } while (present & 0x80000000u);
+    present = le32(p + 4);
+    if (present & 1) off = ((off + 7) & ~(size_t)7) + 8;   /* TSFT */
+    if (!(present & 2) || off >= len) return -1;
+    return off;
+}
+
+/* Parses one captured link layer packet; 1 if it is a WEP data frame */
+static int parse_frame(int linktype, const unsigned char *p, size_t len, rc4lab_frame *fr) {
+    int fcs = 0;
+    switch (linktype) {
+    case LINKTYPE_IEEE802_11:
+        break;
+    case LINKTYPE_IEEE802_11_RADIOTAP: {
+        if (len < 8) return 0;
+        size_t hl = le16(p + 2);
+        if (hl > len) return 0;
+        int f = radiotap_flags(p, hl);
+        if (f >= 0 && (p[f] & 0x10)) fcs = 4;
+        p += hl;
+        len -= hl;
+        break;
+    }
+    case LINKTYPE_IEEE802_11_PRISM:
+        if (len < 144) return 0;
+        p += 144;
+        len -= 144;
+        break;
+    case LINKTYPE_IEEE802_11_AVS: {
+        if (len < 8) return 0;
+        size_t hl = be32(p + 4);
+        if (hl > len) return 0;
+        p += hl;
+        len -= hl;
+        break;
+    }
+    default:
+        return 0;
+    }
+    if (len < 24 + (size_t)fcs) return 0;
+    len -= fcs;
+    unsigned fc = p[0], flags = p[1];
+    if (((fc >> 2) & 3) != 2 || !(flags & 0x40)) return 0;   /* Protected data */
+    size_t hl = 24;
+    if ((flags & 3) == 3) hl += 6;
+    if (fc & 0x80) {                                          /* QoS */
+        hl += 2;
+        if (flags & 0x80) hl += 4;
+    }
+    if (len < hl + 4 + 1 + 4) return 0;                       /* IV, data, ICV */
+    if (p[hl + 3] & 0x20) return 0;                           /* ExtIV: not WEP */
+    switch (flags & 3) {
+    case 0: memcpy(fr->bssid, p + 16, 6); break;
+    case 1: memcpy(fr->bssid, p + 4, 6); break;
+    case 2: memcpy(fr->bssid, p + 10, 6); break;
+    default: memcpy(fr->bssid, p + 4, 6); break;
+    }
+    memcpy(fr->iv, p + hl, RC4LAB_IVLEN);
+    fr->keyid = p[hl + 3] >> 6;
+    fr->body = p + hl + 4;
+    fr->len = len - hl - 4 - 4;
+    return 1;
+}
+
+int rc4lab_pcap_next(rc4lab_pcap *pc, rc4lab_frame *fr) {
+    for (;;) {
+        if (!pc->st && pc->pos - pc->dropped >= DROP_STEP) {
+            size_t to = pc->pos & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+            madvise((void *)(pc->base + pc->dropped), to - pc->dropped, MADV_DONTNEED);
+            pc->dropped = to;
+        }
+        const unsigned char *p = need(pc, 1);
+        if (!p) return pc->st && rc4lab_stream_error(pc->st) ? -1 : 0;
+        if (!pc->ng) {
+            if (!(p = need(pc, 16))) return -1;
+            uint32_t caplen = rd32(pc, p + 8);
+            if (!(p = need(pc, 16 + (size_t)caplen))) return -1;
+            skip(pc, 16 + (size_t)caplen);
+            if (parse_frame(pc->linktype[0], p + 16, caplen, fr)) return 1;
+            continue;
+        }
+        if (!(p = need(pc, 12))) return -1;
+        uint32_t type = le32(p);
+        if (type == 0x0a0d0d0a) {              /* Section header: byte order */
+            uint32_t bom = le32(p + 8);
+            if (bom == 0x1a2b3c4d) pc->swap = 0;
+            else if (bom == 0x4d3c2b1a) pc->swap = 1;
+            else return -1;
+            pc->nif = 0;
+        }
+        type = rd32(pc, p);
+        uint32_t blen = rd32(pc, p + 4);
+        if (blen < 12 || (blen & 3) || !(p = need(pc, blen))) return -1;
+        skip(pc, blen);
+        if (type == 1) {                       /* Interface description */
+            if (pc->nif < MAXIF) pc->linktype[pc->nif] = rd16(pc, p + 8);
+            pc->nif++;
+        } else if (type == 6) {                /* Enhanced packet */
+            if (blen < 32) return -1;
+            uint32_t ifc = rd32(pc, p + 8), caplen = rd32(pc, p + 20);
+            if (caplen > blen - 32) return -1;
+            if (ifc < (uint32_t)pc->nif && ifc < MAXIF &&
+                parse_frame(pc->linktype[ifc], p + 28, caplen, fr)) return 1;
+        } else if (type == 3) {                /* Simple packet */
+            if (blen < 16) return -1;
+            uint32_t caplen = rd32(pc, p + 8);
+            if (caplen > blen - 16) caplen = blen - 16;
+            if (pc->nif > 0 && parse_frame(pc->linktype[0], p + 12, caplen, fr)) return 1;
+        }
+    }
+}
+
+/* The plaintext of every WEP data frame starts with the LLC/SNAP header. The
+   EtherType is assumed to be IPv4 (ARP differs in the last byte) */
+
+static const unsigned char snap[] = {0xAA, 0xAA, 0x03, 0x00, 0x00, 0x00, 0x08, 0x00};
+
+int rc4lab_frame_keystream(const rc4lab_frame *fr, unsigned char *z, int maxz) {
+    int n = 0;
+    while (n < maxz && n < (int)sizeof(snap) && (size_t)n < fr->len) {
+        z[n] = fr->body[n] ^ snap[n];
+        n++;
+    }
+    return n;
+}
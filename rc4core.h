@@ -0,0 +1,204 @@
+//! RC4 core shared by librc4lab and the attack tools (C++ only).
+//
+// RC4 for words of l bits (RC4-n with n=2^l elements). Sizes and masks are
+// compile-time constants in every instantiation. Words are stored as uint8_t
+// for l<=8 and as uint16_t for l=9..16. The C interface for the usual 8-bit
+// cipher is in rc4lab.h.
+
+#ifndef RC4CORE_H
+#define RC4CORE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <type_traits>
+
+// Tracing functions (for debugging purposes)
+
+template<class T>
+void report(const char *name,const T *X,int L) {
+    printf(" *** %s = [",name);
+    for (int n=0;n<L;n++) {
+        if (!(n&0x0F)) printf("\n    ");
+        printf("%02X ",int(X[n]));
+    }
+    printf("\n]\n");
+}
+
+// The swap frequency counters F are only updated when track is true.
+
+template<int l,bool track=false>
+struct RC4 {
+    static const int L=1<<l;  // Number of elements
+    static const int M=L-1;   // Binary mask for elements
+    typedef typename std::conditional<(l<=8),uint8_t,uint16_t>::type word;
+
+    word S[L];         // RC4 state (permutation)
+    word K[L];         // RC4 Expanded (repeated) IV+key
+    int F[L];          // Transposition counters (debug)
+    int I,J;           // RC4 indices
+
+    void reportS() {report("PERM",S,L);}
+    void reportK() {report("KEY",K,L);}
+    void reportF() {report("SWAP FREQ",F,L);}
+
+    template<class T>
+    void expandkey(const T *IV,int IVlen,const T *key,int keylen) {
+        int seedlen=keylen+IVlen;
+        for (I=0,J=0;I<IVlen;I++,J++) K[J]=IV[I]&M;
+        for (I=0;I<keylen;I++,J++) K[J]=key[I]&M;
+        for (;J<L;J++) K[J]=K[J%seedlen];
+    }
+
+    void swap() {
+        if (track && I!=J) {F[I]++;F[J]++;}
+        word T=S[I];
+        S[I]=S[J];
+        S[J]=T;
+    }
+
+    void initperm() {
+        if (track) for (I=0;I<L;I++) F[I]=0;
+        for (I=0;I<L;I++) S[I]=I;
+        J=0;
+        for (I=0;I<L;I++) {
+            J+=S[I]+K[I];J&=M;
+            swap();
+        }
+        I=0;J=0;
+    }
+
+    word genbyte() {
+        I++;I&=M;
+        J+=S[I];J&=M;
+        swap();
+        return S[(S[I]+S[J])&M];
+    }
+
+    // First keystream word for the expanded key K, without keeping any state.
+    static word firstword(const word *K) {
+        word S[L];
+        for (int i=0;i<L;i++) S[i]=i;
+        int j=0;
+        for (int i=0;i<L;i++) {
+            j=(j+S[i]+K[i])&M;
+            word T=S[i];S[i]=S[j];S[j]=T;
+        }
+        j=S[1];
+        word T=S[1];S[1]=S[j];S[j]=T;
+        return S[(S[1]+S[j])&M];
+    }
+};
+
+// First word attack with the magic IVs (n+3,-1,x) (see rc4.cpp).
+// fmsofs() is the constant part of the offset for key word n, and fmsvote()
+// the candidate for key word n given the previous words and the first
+// keystream word z.
+
+template<int l>
+inline int fmsofs(int n) {
+    int ofs=3;
+    for (int m=0;m<=n;m++) ofs+=m+3;
+    return ofs&RC4<l>::M;
+}
+
+template<int l,class T>
+inline int fmsvote(int n,const T *kprefix,int x,int z) {
+    int v=z-fmsofs<l>(n)-x;
+    for (int m=0;m<n;m++) v-=kprefix[m];
+    return v&RC4<l>::M;
+}
+
+// Log-likelihood weights of the votes.
+// The vote of the IV (A,-1,x) for key word n=A-3 is right when the KSA
+// leaves S[0], S[1] and S[A] alone after step A (the "resolved" condition of
+// Fluhrer, Mantin and Shamir), and is otherwise uniformly distributed. Step 2
+// swaps S[2] and S[A+2+x]: when A+2+x is 0, 1 or one of 3..A, the condition
+// fails (or the offset of fmsvote() is wrong) whatever the key, and the vote
+// carries no information. For the other x the condition holds with
+// probability about
+//   p_A = (1-3/L)..(1-(A-1)/L) * (1-(A+1)/L) * (1-3/L)^(L-1-A)
+// (about e^-3 for small A; within a few percent of the measured rate for
+// 8-bit words, optimistic for words of 5 bits or less). The log-likelihood of
+// a candidate is then, up to a constant, the number of votes it got times
+//   log(1 + p_A*L/(1-p_A)),
+// so each vote adds that weight, scaled by LLRSCALE and rounded (at least 1,
+// so that the candidates of a key word are still ordered by their votes).
+// A sum vote (ptwvotes()) is right with probability about 1.36/L, and weighs
+// log(1.36) in the same scale.
+//
+// The weights per IV class are tabulated at compile time for every word
+// size (fmsweights<l>); fmsweight() is the weight of one vote, 0 for the
+// useless x.
+
+const int LLRSCALE=16;
+
+// Natural logarithm for y>=1 (constexpr)
+constexpr double llrlog(double y) {
+    int k=0;
+    while (y>2) {y/=2;k++;}
+    double u=(y-1)/(y+1),u2=u*u,t=u,s=0;
+    for (int i=1;i<40;i+=2) {s+=t/i;t*=u2;}
+    return 2*s+k*0.69314718055994531;
+}
+
+constexpr int llrweight(double llr) {
+    int w=int(LLRSCALE*llr+0.5);
+    return w<1?1:w;
+}
+
+template<int l>
+struct fmsweights {
+    static const int L=RC4<l>::L;
+    int w[L];          // Weight of a vote for key word n (IV class n+3)
+    constexpr fmsweights():w() {
+        double p1=1,q=1;   // (1-3/L)..(1-(A-1)/L) and (1-3/L)^(L-1-A)
+        for (int i=0;i<L-4;i++) q*=1-3.0/L;
+        for (int A=3;A<L;A++) {
+            double p=p1*(1-(A+1.0)/L)*q;
+            w[A-3]=llrweight(llrlog(1+p*L/(1-p)));
+            p1*=1-double(A)/L;
+            q/=1-3.0/L;
+        }
+    }
+};
+
+template<int l>
+constexpr fmsweights<l> fmsweighttable{};
+
+const int ptwweight=llrweight(llrlog(1.36));
+
+template<int l>
+inline int fmsweight(int n,int x) {
+    int t=(n+5+x)&RC4<l>::M;   // A+2+x
+    if (t<2 || (t>2 && t<=n+3)) return 0;
+    return fmsweighttable<l>.w[n];
+}
+
+// Single pass attack on all the key words (Klein's correlation, in the
+// simplified form of Pyshkin, Tews and Weinmann). With S and j the state
+// after the ivlen IV steps of the KSA, the keystream word z_i (i>=ivlen,
+// counting from 1) is likely to satisfy
+//   key[0]+..+key[i-ivlen] = S^-1[i-z_i] - (j+S[ivlen]+..+S[i])
+// for any IV. ptwvotes() stores these candidate sums in sigma[0..] for the
+// nz keystream words z[0..nz-1] and returns how many there are.
+
+template<int l,class T>
+inline int ptwvotes(const T *iv,int ivlen,const T *z,int nz,int *sigma) {
+    const int L=RC4<l>::L,M=RC4<l>::M;
+    typename RC4<l>::word S[L],Si[L];
+    for (int i=0;i<L;i++) S[i]=i;
+    int j=0;
+    for (int i=0;i<ivlen;i++) {
+        j=(j+S[i]+iv[i])&M;
+        typename RC4<l>::word t=S[i];S[i]=S[j];S[j]=t;
+    }
+    for (int i=0;i<L;i++) Si[S[i]]=i;
+    int n=0;
+    for (int i=ivlen;i<=nz && i<L;i++,n++) {
+        j+=S[i];
+        sigma[n]=(Si[(i-z[i-1])&M]-j)&M;
+    }
+    return n;
+}
+
+#endif
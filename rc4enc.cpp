@@ -20,76 +20,17 @@ extern "C" {
     #include <time.h>
     #include <string.h>
 }
+#include "rc4lab.h"
 
 const int l=8;     // Bitlength of the elements (words)
 const int L=1<<l;  // Number of elements
-const int M=L-1;   // Binary mask for elements
 
-int S[L];          // RC4 state (permutation)
-int K[L];          // RC4 Expanded (repeated) IV+key
-int F[L];          // Transposition counters (debug)
-int I,J;           // RC4 indices
-int key[L];        // Long-term key
+rc4lab_ctx *ctx;   // RC4 state (see rc4lab.h)
+unsigned char key[L]; // Long-term key
 
 int keylen=8;      // Length (in words) of the long-term key
 int outlen=256;    // Length (in words) of the output key stream
 
-// Tracing functions (for debugging purposes)
-
-void report(const char *name,const int *X) {
-    printf(" *** %s = [",name);
-    for (int n=0;n<L;n++) {
-        if (!(n&0x0F)) printf("\n    ");
-        printf("%02X ",X[n]);
-    }
-    printf("\n]\n");
-}
-
-void reportS() {report("PERM",S);}
-void reportK() {report("KEY",K);}
-void reportF() {report("SWAP FREQ",F);}
-
-// Generate a random long-term key
-
-void randkey() {
-    for (int i=0;i<keylen;i++) key[i]=rand()&M;
-}
-
-// RC4 implementation
-
-void expandkey() {
-    int seedlen=keylen;
-    for (I=0;I<keylen;I++) K[I]=key[I]&M;
-    for (;I<L;I++) K[I]=K[I%seedlen];
-}
-
-void swap() {
-//printf("        (%02X,%02X)\n",I,J);
-    if (I!=J) {F[I]++;F[J]++;}
-    int T=S[I];
-    S[I]=S[J];
-    S[J]=T;
-}
-void initperm() {
-    for (I=0;I<L;I++) F[I]=0;
-    for (I=0;I<L;I++) S[I]=I;
-//reportS();
-    J=0;
-    for (I=0;I<L;I++) {
-        J+=S[I]+K[I];J&=M;
-        swap();
-//reportS();
-    }
-    I=0;J=0;
-}
-
-unsigned char genbyte() {
-    I++;I&=M;
-    J+=S[I];J&=M;
-    swap();
-    return S[(S[I]+S[J])&M];
-}
-
 void readkey() {
     unsigned char b;
     int i;
@@ -106,16 +47,6 @@ void readkey() {
     } else if (fread(&b,1,1,stdin)==1) fprintf(stderr,"Key is too long: ignoring extra bytes\n");
 }
 
-int hexval(char c) {
-    if (c<'0') return -1;
-    if (c<='9') return c-'0';
-    if (c<'A') return -1;
-    if (c<='F') return c-'A'+10;
-    if (c<'a') return -1;
-    if (c<='f') return c-'a'+10;
-    return -1;
-}
-
 void read_hexkey(const char *k) {
     if (!k) {
         fprintf(stderr,"Missing hexkey string\n");
@@ -125,7 +56,7 @@ void read_hexkey(const char *k) {
     for (i=0;i<keylen;i++) {
         if (!*k) break;
         int x0,x1;
-        if ((x0=hexval(*k++))<0 || !*k || (x1=hexval(*k++))<0) {
+        if ((x0=rc4lab_hexval(*k++))<0 || !*k || (x1=rc4lab_hexval(*k++))<0) {
             fprintf(stderr,"Badly formed hexkey string\n");
             exit(1);
         }
@@ -138,108 +69,118 @@ void read_hexkey(const char *k) {
 }
 
 void initRC4() {
-    expandkey();
-//reportK();
-    initperm();
-//reportS();
-//reportF();
+    if (!(ctx=rc4lab_new())) {
+        fprintf(stderr,"Out of memory\n");
+        exit(1);
+    }
+    rc4lab_setkey(ctx,key,keylen);
+}
+
+// Streams are processed in blocks of BLK bytes
+
+const int BLK=1<<16;
+unsigned char buf[BLK];
+
+// Hex streams (option -x): the input is hexadecimal text, in lines of any
+// length, and the output is written in lines of HEXLINE bytes. Lines are
+// delimited with memchr() and the digits decoded or encoded a block at a
+// time with the vectorised codec of the library.
+
+bool hexmode=false;
+const int HEXLINE=32;
+char hextext[2*BLK+1];                     // Input digits
+char hexout[2*BLK+BLK/HEXLINE+3];          // Output lines
+int hexcol=0;                              // Bytes in the current output line
+
+// Decodes the next block of input into out (at most BLK bytes); *eof is set
+// at the end of the input.
+size_t readhex(unsigned char *out,bool *eof) {
+    static size_t carry=0;                 // Odd digit left from the previous block
+    size_t want=2*BLK-carry;
+    size_t n=fread(hextext+carry,1,want,stdin);
+    if (n<want && ferror(stdin)) {
+        fprintf(stderr,"Input error while reading hex stream from stdin\n");
+        exit(1);
+    }
+    *eof=n<want;
+    char *s=hextext+carry,*e=s+n,*d=s;
+    while (s<e) {
+        char *nl=(char *)memchr(s,'\n',e-s);
+        char *t=nl?nl:e;
+        while (t>s && (t[-1]=='\r' || t[-1]==' ' || t[-1]=='\t')) t--;
+        memmove(d,s,t-s);
+        d+=t-s;
+        s=nl?nl+1:e;
+    }
+    size_t nd=d-hextext;
+    if (rc4lab_hex_decode(hextext,nd&~size_t(1),out)<0) {
+        fprintf(stderr,"Badly formed hex stream\n");
+        exit(1);
+    }
+    carry=nd&1;
+    if (carry) {
+        if (*eof) {
+            fprintf(stderr,"Odd number of digits in hex stream\n");
+            exit(1);
+        }
+        hextext[0]=hextext[nd-1];
+    }
+    return nd/2;
+}
+
+void writehex(const unsigned char *p,size_t n,bool last) {
+    char *o=hexout;
+    while (n) {
+        size_t k=n<size_t(HEXLINE-hexcol)?n:HEXLINE-hexcol;
+        rc4lab_hex_encode(p,k,o);
+        o+=2*k;p+=k;n-=k;hexcol+=k;
+        if (hexcol==HEXLINE) {*o++='\n';hexcol=0;}
+    }
+    if (last && hexcol) {*o++='\n';hexcol=0;}
+    if (fwrite(hexout,1,o-hexout,stdout)!=size_t(o-hexout)) {
+        fprintf(stderr,"Output error while writing hex stream to stdout\n");
+        exit(1);
+    }
 }
 
 void outkeystream() {
-    unsigned char o;
-    for (int i=0;i<outlen;i++)
-        if (fwrite((o=genbyte(),&o),1,1,stdout)!=1) {
+    for (int i=0;i<outlen;i+=BLK) {
+        int n=outlen-i<BLK?outlen-i:BLK;
+        rc4lab_keystream(ctx,buf,n);
+        if (hexmode) {
+            writehex(buf,n,i+n==outlen);
+            continue;
+        }
+        if (fwrite(buf,1,n,stdout)!=(size_t)n) {
             fprintf(stderr,"Output error while writing key stream to stdout\n");
             exit(1);
         }
+    }
 }
 
 void encrypt() {
-    unsigned char i,o;
+    while (hexmode) {
+        bool eof;
+        size_t n=readhex(buf,&eof);
+        rc4lab_xor(ctx,buf,buf,n);
+        writehex(buf,n,eof);
+        if (eof) return;
+    }
     while (1) {
-        if (fread(&i,1,1,stdin)!=1) {
-            if (feof(stdin)) break;
+        size_t n=fread(buf,1,BLK,stdin);
+        if (n<BLK && ferror(stdin)) {
             fprintf(stderr,"Input error while reading plaintext stream from stdin\n");
             exit(1);
         }
-        if (fwrite((o=genbyte()^i,&o),1,1,stdout)!=1) {
+        rc4lab_xor(ctx,buf,buf,n);
+        if (fwrite(buf,1,n,stdout)!=n) {
             fprintf(stderr,"Output error while writing ciphettext stream to stdout\n");
             exit(1);
         }
+        if (n<BLK) break;
     }
 }
 
-// Generate test vectors
-
-int offsets[]={0,16,240,256,496,512,752,768,1008,1024,1520,1536,2032,2048,3056,3072,4080,4096,-1};
-
-void testvector(int len,int *p) {
-    keylen=len;
-    for (int i=0;i<keylen;i++) key[i]=p[i];
-    printf("\nKey length: %d bits.\n",l*keylen);
-    printf("key: 0x");
-    for (int i=0;i<keylen;i++) printf("%02x",key[i]);
-    printf("\n");
-    expandkey();
-    initperm();
-    int lastoffs=0;
-    for (int n=0;offsets[n]>=0;n++) {
-        for (int i=offsets[n];i>lastoffs;i--) genbyte();
-        lastoffs=offsets[n];
-        printf("\nDEC %4d HEX %4x: ",lastoffs,lastoffs);
-        for (int i=0;i<4;i++) printf("%02x ",genbyte());
-        printf(" ");
-        for (int i=0;i<4;i++) printf("%02x ",genbyte());
-        printf("  ");
-        for (int i=0;i<4;i++) printf("%02x ",genbyte());
-        printf(" ");
-        for (int i=0;i<4;i++) printf("%02x ",genbyte());
-        lastoffs+=16;
-    }
-    printf("\n");
-}
-
-int testkey0[]={1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,
-    17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,32};
-int testkey5[]={0x83,0x32,0x22,0x77,0x2a};
-int testkey7[]={0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
-int testkey8[]={
-    0x64,0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
-int testkey10[]={
-    0x8b,0x37,0x64,0x19,0x10,0x83,0x32,0x22,
-    0x77,0x2a};
-int testkey16[]={
-    0xeb,0xb4,0x62,0x27,0xc6,0xcc,0x8b,0x37,
-    0x64,0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
-int testkey24[]={
-    0xc1,0x09,0x16,0x39,0x08,0xeb,0xe5,0x1d,
-    0xeb,0xb4,0x62,0x27,0xc6,0xcc,0x8b,0x37,
-    0x64,0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
-int testkey32[]={
-    0x1a,0xda,0x31,0xd5,0xcf,0x68,0x82,0x21,
-    0xc1,0x09,0x16,0x39,0x08,0xeb,0xe5,0x1d,
-    0xeb,0xb4,0x62,0x27,0xc6,0xcc,0x8b,0x37,
-    0x64,0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
-
-
-void testvectors() {
-    printf("\nThis must produce the test vectors in https://tools.ietf.org/html/rfc6229\n");
-    testvector(5,testkey0);
-    testvector(7,testkey0);
-    testvector(8,testkey0);
-    testvector(10,testkey0);
-    testvector(16,testkey0);
-    testvector(24,testkey0);
-    testvector(32,testkey0);
-    testvector(5,testkey5);
-    testvector(7,testkey7);
-    testvector(8,testkey8);
-    testvector(10,testkey10);
-    testvector(16,testkey16);
-    testvector(24,testkey24);
-    testvector(32,testkey32);
-}
-
 int verbosity=0;
 bool onlystream=false;
 bool keyfromargs=false;
@@ -294,13 +235,15 @@ int processoption(const char *opt,const char *arg) {
             continue;
             case 't': onlytest=true;
             continue;
+            case 'x': hexmode=true;
+            continue;
             case 'h': onlyhelp=true;
             continue; 
             case 0: return consumearg? 1 : 0;
         }
         break;
     }
-    fprintf(stderr,"Unknown option '-%c'\nThe only valid options are: -L -S -K -t -v -h.\n",opt[-1]);
+    fprintf(stderr,"Unknown option '-%c'\nThe only valid options are: -L -S -K -x -t -v -h.\n",opt[-1]);
     exit(1);
     return 0;
 }
@@ -313,6 +256,7 @@ void givehelp(const char* appname=0) {
     fprintf(stderr,"  -L <LEN>: Set key length to <LEN> bytes (default: 8)\n");
     fprintf(stderr,"  -S <LEN>: Don't encrypt and generate <LEN> keystream bytes (default: 256)\n");
     fprintf(stderr,"  -K <HEX>: Use key given by the hexadecimal string <HEX>\n");
+    fprintf(stderr,"  -x: Hex streams: read and write hexadecimal text instead of binary data\n");
     fprintf(stderr,"  -t: Only generate test vectors (to check the RC4 implementation)\n");
     fprintf(stderr,"  -v: Be more verbous\n");
     fprintf(stderr,"  -h: Print this help text\n");
@@ -337,7 +281,7 @@ int main(int argc, char *argv[]) {
         exit(0);
     }
     if (onlytest) {
-        testvectors();
+        rc4lab_testvectors(stdout);
         exit(0);
     }
     if (!keyfromargs) {
@@ -0,0 +1,158 @@
+/*! librc4lab: hexadecimal encoding and decoding.
+ *
+ * Whole buffers are converted 16 (SSSE3) or 32 (AVX2) bytes at a time; the
+ * instruction set is chosen at run time, and the tails (or other CPUs) use
+ * the scalar code. Decoding validates every digit.
+ */
+
+#include <stdint.h>
+#include "rc4lab.h"
+
+static const char digits[] = "0123456789ABCDEF";
+
+int rc4lab_hexval(int c) {
+    if (c < '0') return -1;
+    if (c <= '9') return c - '0';
+    if (c < 'A') return -1;
+    if (c <= 'F') return c - 'A' + 10;
+    if (c < 'a') return -1;
+    if (c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+/* Scalar versions; decode returns 0 if a digit is not valid */
+
+static int decode_scalar(const char *hex, size_t n, unsigned char *out) {
+    for (size_t i = 0; i < n; i++) {
+        int x0 = rc4lab_hexval(hex[2 * i]), x1 = rc4lab_hexval(hex[2 * i + 1]);
+        if (x0 < 0 || x1 < 0) return 0;
+        out[i] = x0 * 16 + x1;
+    }
+    return 1;
+}
+
+static void encode_scalar(const unsigned char *in, size_t n, char *out) {
+    for (size_t i = 0; i < n; i++) {
+        out[2 * i] = digits[in[i] >> 4];
+        out[2 * i + 1] = digits[in[i] & 15];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* Digit values of 16 characters; *bad gets nonzero lanes for invalid ones.
+   '0'-'9' map to c-'0' and letters (in either case) to (c|0x20)-'a'+10. */
+__attribute__((target("ssse3")))
+static inline __m128i nibbles128(__m128i c, __m128i *bad) {
+    __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    __m128i a = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i isd = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    __m128i isa = _mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(5)), a);
+    *bad = _mm_or_si128(*bad, _mm_andnot_si128(_mm_or_si128(isd, isa), _mm_set1_epi8(-1)));
+    return _mm_or_si128(_mm_and_si128(isd, d), _mm_and_si128(isa, _mm_add_epi8(a, _mm_set1_epi8(10))));
+}
+
+__attribute__((target("ssse3")))
+static int decode_ssse3(const char *hex, size_t n, unsigned char *out) {
+    __m128i bad = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = nibbles128(_mm_loadu_si128((const __m128i *)(hex + 2 * i)), &bad);
+        /* hi*16+lo for every pair, then narrowed to bytes */
+        __m128i w = _mm_maddubs_epi16(v, _mm_set1_epi16(0x0110));
+        _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(w, w));
+    }
+    if (_mm_movemask_epi8(bad)) return 0;
+    return decode_scalar(hex + 2 * i, n - i, out + i);
+}
+
+__attribute__((target("ssse3")))
+static void encode_ssse3(const unsigned char *in, size_t n, char *out) {
+    const __m128i lut = _mm_loadu_si128((const __m128i *)digits);
+    const __m128i mask = _mm_set1_epi8(15);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(b, 4), mask));
+        __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(b, mask));
+        _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    encode_scalar(in + i, n - i, out + 2 * i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i nibbles256(__m256i c, __m256i *bad) {
+    __m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+    __m256i a = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i isd = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+    __m256i isa = _mm256_cmpeq_epi8(_mm256_min_epu8(a, _mm256_set1_epi8(5)), a);
+    *bad = _mm256_or_si256(*bad, _mm256_andnot_si256(_mm256_or_si256(isd, isa), _mm256_set1_epi8(-1)));
+    return _mm256_or_si256(_mm256_and_si256(isd, d), _mm256_and_si256(isa, _mm256_add_epi8(a, _mm256_set1_epi8(10))));
+}
+
+__attribute__((target("avx2")))
+static int decode_avx2(const char *hex, size_t n, unsigned char *out) {
+    __m256i bad = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = nibbles256(_mm256_loadu_si256((const __m256i *)(hex + 2 * i)), &bad);
+        __m256i w = _mm256_maddubs_epi16(v, _mm256_set1_epi16(0x0110));
+        /* packus works per 128-bit lane: keep quadwords 0 and 2 */
+        __m256i p = _mm256_permute4x64_epi64(_mm256_packus_epi16(w, w), 0x08);
+        _mm_storeu_si128((__m128i *)(out + i), _mm256_castsi256_si128(p));
+    }
+    if (_mm256_movemask_epi8(bad)) return 0;
+    return decode_ssse3(hex + 2 * i, n - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static void encode_avx2(const unsigned char *in, size_t n, char *out) {
+    const __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)digits));
+    const __m256i mask = _mm256_set1_epi8(15);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i b = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(b, 4), mask));
+        __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(b, mask));
+        /* Per lane: bytes 0-7 and 16-23, then 8-15 and 24-31 */
+        __m256i x = _mm256_unpacklo_epi8(hi, lo), y = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)(out + 2 * i), _mm256_permute2x128_si256(x, y, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + 2 * i + 32), _mm256_permute2x128_si256(x, y, 0x31));
+    }
+    encode_ssse3(in + i, n - i, out + 2 * i);
+}
+#endif
+
+static int (*decode)(const char *, size_t, unsigned char *);
+static void (*encode)(const unsigned char *, size_t, char *);
+
+/* Picks the implementations for this CPU (racing threads store the same
+   pointers) */
+static void dispatch(void) {
+    decode = decode_scalar;
+    encode = encode_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        decode = decode_avx2;
+        encode = encode_avx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        decode = decode_ssse3;
+        encode = encode_ssse3;
+    }
+#endif
+}
+
+long rc4lab_hex_decode(const char *hex, size_t len, unsigned char *out) {
+    if (len & 1) return -1;
+    if (!decode) dispatch();
+    return decode(hex, len / 2, out) ? (long)(len / 2) : -1;
+}
+
+void rc4lab_hex_encode(const unsigned char *in, size_t n, char *out) {
+    if (!encode) dispatch();
+    encode(in, n, out);
+    out[2 * n] = 0;
+}
@@ -0,0 +1,257 @@
+//! librc4lab: implementation of the C interface in rc4lab.h.
+// The cipher is the 8-bit instantiation of the core in rc4core.h.
+
+extern "C" {
+    #include <stdlib.h>
+    #include <stdio.h>
+    #include <string.h>
+    #include <errno.h>
+}
+#include "rc4core.h"
+#include "rc4lab.h"
+
+typedef RC4<8> rc4;
+
+struct rc4lab_ctx {
+    rc4 rc;
+};
+
+struct rc4lab_votes {
+    int npos;
+    unsigned *h;       // npos histograms of 256 counters
+};
+
+// Cipher context
+
+rc4lab_ctx *rc4lab_new(void) {
+    rc4lab_ctx *ctx=(rc4lab_ctx *)calloc(1,sizeof(rc4lab_ctx));
+    return ctx;
+}
+
+void rc4lab_free(rc4lab_ctx *ctx) {
+    free(ctx);
+}
+
+int rc4lab_setkey(rc4lab_ctx *ctx,const unsigned char *key,int keylen) {
+    return rc4lab_setkey_iv(ctx,NULL,0,key,keylen);
+}
+
+int rc4lab_setkey_iv(rc4lab_ctx *ctx,const unsigned char *iv,int ivlen,const unsigned char *key,int keylen) {
+    if (keylen<1 || ivlen<0 || ivlen>=rc4::L) {
+        errno=EINVAL;
+        return -1;
+    }
+    if (keylen>rc4::L-ivlen) keylen=rc4::L-ivlen;
+    ctx->rc.expandkey(iv,ivlen,key,keylen);
+    ctx->rc.initperm();
+    return 0;
+}
+
+void rc4lab_keystream(rc4lab_ctx *ctx,unsigned char *out,size_t n) {
+    rc4 &rc=ctx->rc;
+    for (size_t i=0;i<n;i++) out[i]=rc.genbyte();
+}
+
+void rc4lab_skip(rc4lab_ctx *ctx,size_t n) {
+    rc4 &rc=ctx->rc;
+    for (size_t i=0;i<n;i++) rc.genbyte();
+}
+
+void rc4lab_xor(rc4lab_ctx *ctx,const unsigned char *in,unsigned char *out,size_t n) {
+    rc4 &rc=ctx->rc;
+    for (size_t i=0;i<n;i++) out[i]=in[i]^rc.genbyte();
+}
+
+// The key is expanded once, and only the positions holding IV bytes are
+// rewritten for every seed.
+
+void rc4lab_first_bytes(const unsigned char *ivs,size_t n,const unsigned char *key,int keylen,unsigned char *z) {
+    const int ivlen=RC4LAB_IVLEN;
+    if (keylen<0) keylen=0;
+    if (keylen>rc4::L-ivlen) keylen=rc4::L-ivlen;
+    int seedlen=ivlen+keylen;
+    rc4::word K[rc4::L];
+    for (int i=0;i<rc4::L;i++) K[i]=i%seedlen<ivlen?0:key[i%seedlen-ivlen];
+    for (size_t r=0;r<n;r++,ivs+=ivlen) {
+        for (int i=0;i<rc4::L;i+=seedlen)
+            for (int j=0;j<ivlen && i+j<rc4::L;j++) K[i+j]=ivs[j];
+        z[r]=rc4::firstword(K);
+    }
+}
+
+size_t rc4lab_verify(const unsigned char *key,int keylen,const unsigned char *ivs,const unsigned char *z,size_t n) {
+    unsigned char buf[256];
+    size_t ok=0;
+    while (n) {
+        size_t b=n<sizeof(buf)?n:sizeof(buf);
+        rc4lab_first_bytes(ivs,b,key,keylen,buf);
+        for (size_t i=0;i<b;i++) ok+=buf[i]==z[i];
+        ivs+=b*RC4LAB_IVLEN;
+        z+=b;
+        n-=b;
+    }
+    return ok;
+}
+
+// Generate test vectors
+
+static const int offsets[]={0,16,240,256,496,512,752,768,1008,1024,1520,1536,2032,2048,3056,3072,4080,4096,-1};
+
+static void testvector(FILE *f,int len,const unsigned char *p) {
+    rc4lab_ctx ctx;
+    fprintf(f,"\nKey length: %d bits.\n",8*len);
+    fprintf(f,"key: 0x");
+    for (int i=0;i<len;i++) fprintf(f,"%02x",p[i]);
+    fprintf(f,"\n");
+    rc4lab_setkey(&ctx,p,len);
+    int lastoffs=0;
+    for (int n=0;offsets[n]>=0;n++) {
+        unsigned char z[16];
+        rc4lab_skip(&ctx,offsets[n]-lastoffs);
+        lastoffs=offsets[n];
+        rc4lab_keystream(&ctx,z,16);
+        fprintf(f,"\nDEC %4d HEX %4x: ",lastoffs,lastoffs);
+        for (int i=0;i<4;i++) fprintf(f,"%02x ",z[i]);
+        fprintf(f," ");
+        for (int i=4;i<8;i++) fprintf(f,"%02x ",z[i]);
+        fprintf(f,"  ");
+        for (int i=8;i<12;i++) fprintf(f,"%02x ",z[i]);
+        fprintf(f," ");
+        for (int i=12;i<16;i++) fprintf(f,"%02x ",z[i]);
+        lastoffs+=16;
+    }
+    fprintf(f,"\n");
+}
+
+static const unsigned char testkey0[]={1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,
+    17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,32};
+static const unsigned char testkey5[]={0x83,0x32,0x22,0x77,0x2a};
+static const unsigned char testkey7[]={0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
+static const unsigned char testkey8[]={
+    0x64,0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
+static const unsigned char testkey10[]={
+    0x8b,0x37,0x64,0x19,0x10,0x83,0x32,0x22,
+    0x77,0x2a};
+static const unsigned char testkey16[]={
+    0xeb,0xb4,0x62,0x27,0xc6,0xcc,0x8b,0x37,
+    0x64,0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
+static const unsigned char testkey24[]={
+    0xc1,0x09,0x16,0x39,0x08,0xeb,0xe5,0x1d,
+    0xeb,0xb4,0x62,0x27,0xc6,0xcc,0x8b,0x37,
+    0x64,0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
+static const unsigned char testkey32[]={
+    0x1a,0xda,0x31,0xd5,0xcf,0x68,0x82,0x21,
+    0xc1,0x09,0x16,0x39,0x08,0xeb,0xe5,0x1d,
+    0xeb,0xb4,0x62,0x27,0xc6,0xcc,0x8b,0x37,
+    0x64,0x19,0x10,0x83,0x32,0x22,0x77,0x2a};
+
+void rc4lab_testvectors(FILE *f) {
+    fprintf(f,"\nThis must produce the test vectors in https://tools.ietf.org/html/rfc6229\n");
+    testvector(f,5,testkey0);
+    testvector(f,7,testkey0);
+    testvector(f,8,testkey0);
+    testvector(f,10,testkey0);
+    testvector(f,16,testkey0);
+    testvector(f,24,testkey0);
+    testvector(f,32,testkey0);
+    testvector(f,5,testkey5);
+    testvector(f,7,testkey7);
+    testvector(f,8,testkey8);
+    testvector(f,10,testkey10);
+    testvector(f,16,testkey16);
+    testvector(f,24,testkey24);
+    testvector(f,32,testkey32);
+}
+
+// Vote accumulation
+
+int rc4lab_vote(int n,const unsigned char *kprefix,const unsigned char *iv,unsigned char z) {
+    if (n<0 || iv[0]!=((n+3)&0xFF) || iv[1]!=0xFF) return -1;
+    return fmsvote<8>(n,kprefix,iv[2],z);
+}
+
+static_assert(RC4LAB_SUM_WEIGHT==ptwweight,"RC4LAB_SUM_WEIGHT does not match rc4core.h");
+
+unsigned rc4lab_vote_weight(int n,const unsigned char *iv) {
+    if (n<0 || iv[0]!=((n+3)&0xFF) || iv[1]!=0xFF) return 0;
+    return fmsweight<8>(n,iv[2]);
+}
+
+int rc4lab_sum_votes(const unsigned char *iv,const unsigned char *z,int nz,unsigned char *sigma) {
+    int v[rc4::L];
+    int n=ptwvotes<8>(iv,RC4LAB_IVLEN,z,nz,v);
+    for (int i=0;i<n;i++) sigma[i]=v[i];
+    return n;
+}
+
+rc4lab_votes *rc4lab_votes_new(int npos) {
+    rc4lab_votes *v=(rc4lab_votes *)malloc(sizeof(rc4lab_votes));
+    if (!v) return NULL;
+    v->npos=npos;
+    if (!(v->h=(unsigned *)calloc((size_t)npos*256,sizeof(unsigned)))) {
+        free(v);
+        return NULL;
+    }
+    return v;
+}
+
+void rc4lab_votes_free(rc4lab_votes *v) {
+    if (!v) return;
+    free(v->h);
+    free(v);
+}
+
+void rc4lab_votes_clear(rc4lab_votes *v,int pos) {
+    memset(v->h+(size_t)pos*256,0,256*sizeof(unsigned));
+}
+
+void rc4lab_votes_add(rc4lab_votes *v,int pos,int value,unsigned weight) {
+    v->h[(size_t)pos*256+(value&0xFF)]+=weight;
+}
+
+unsigned rc4lab_votes_get(const rc4lab_votes *v,int pos,int value) {
+    return v->h[(size_t)pos*256+(value&0xFF)];
+}
+
+int rc4lab_votes_best(const rc4lab_votes *v,int pos,const unsigned char *allowed,unsigned *freq) {
+    const unsigned *h=v->h+(size_t)pos*256;
+    unsigned fmax=0;
+    int fmaxind=0;
+    for (int i=0;i<256;i++)
+        if ((!allowed || allowed[i]) && h[i]>fmax) {
+            fmax=h[i];
+            fmaxind=i;
+        }
+    if (freq) *freq=fmax;
+    return fmaxind;
+}
+
+// Capture records
+
+// The fields are delimited first and then decoded (and validated) at once.
+
+static const char *hexfield(const char *s,const char *end,size_t *len) {
+    if (s[0]!='0' || (s[1]!='X' && s[1]!='x')) return NULL;
+    s+=2;
+    *len=strcspn(s,end);
+    return s;
+}
+
+int rc4lab_parse_record(const char *line,unsigned char *iv,unsigned char *c,int maxc) {
+    size_t n;
+    const char *s=hexfield(line," \r\n",&n);
+    if (!s || n!=2*RC4LAB_IVLEN || s[n]!=' ' || rc4lab_hex_decode(s,n,iv)<0) return -1;
+    if (!(s=hexfield(s+n+1,"\r\n",&n)) || !n || (n&1)) return -1;
+    if (n>2*(size_t)maxc) n=2*maxc;
+    return rc4lab_hex_decode(s,n,c);
+}
+
+int rc4lab_format_record(char *out,const unsigned char *iv,const unsigned char *c,int nc) {
+    out[0]='0';out[1]='X';
+    rc4lab_hex_encode(iv,RC4LAB_IVLEN,out+2);
+    out[2+2*RC4LAB_IVLEN]=' ';
+    char *p=out+3+2*RC4LAB_IVLEN;
+    p[0]='0';p[1]='X';
+    rc4lab_hex_encode(c,nc,p+2);
+    return 5+2*RC4LAB_IVLEN+2*nc;
+}
@@ -0,0 +1,176 @@
+/*! librc4lab: RC4 cipher and WEP attack primitives (8-bit words).
+ *
+ * Stable C interface shared by rc4, rc4enc, attack and simul, and meant to
+ * be linked by other programs. All the functions are thread safe as long as
+ * each context/vote table is used by one thread at a time.
+ *
+ * Capture records are text lines "0XIIIIII 0XCC..": the 3-byte IV and the
+ * ciphertext (or keystream) bytes, in hexadecimal.
+ */
+
+#ifndef RC4LAB_H
+#define RC4LAB_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RC4LAB_IVLEN 3
+
+/* Cipher context */
+
+typedef struct rc4lab_ctx rc4lab_ctx;
+
+rc4lab_ctx *rc4lab_new(void);
+void rc4lab_free(rc4lab_ctx *ctx);
+/* Key setup with key, or with iv||key (WEP style seed); the seed is cut to
+   256 bytes. Returns -1 (EINVAL) unless keylen>=1 and 0<=ivlen<256 */
+int rc4lab_setkey(rc4lab_ctx *ctx,const unsigned char *key,int keylen);
+int rc4lab_setkey_iv(rc4lab_ctx *ctx,const unsigned char *iv,int ivlen,const unsigned char *key,int keylen);
+void rc4lab_keystream(rc4lab_ctx *ctx,unsigned char *out,size_t n);
+void rc4lab_skip(rc4lab_ctx *ctx,size_t n);
+/* out=in^keystream (in and out may be the same buffer) */
+void rc4lab_xor(rc4lab_ctx *ctx,const unsigned char *in,unsigned char *out,size_t n);
+
+/* First keystream byte for n seeds ivs[i]||key (ivs holds n 3-byte IVs) */
+void rc4lab_first_bytes(const unsigned char *ivs,size_t n,const unsigned char *key,int keylen,unsigned char *z);
+
+/* Number of the n records (ivs[i],z[i]) whose first keystream byte under
+   ivs[i]||key is z[i] */
+size_t rc4lab_verify(const unsigned char *key,int keylen,const unsigned char *ivs,const unsigned char *z,size_t n);
+
+/* Print the test vectors of RFC 6229 */
+void rc4lab_testvectors(FILE *f);
+
+/* Vote accumulation for the first byte attack with IVs (n+3,FF,x) */
+
+typedef struct rc4lab_votes rc4lab_votes;
+
+/* Candidate for key byte n from the first keystream byte z of iv, given the
+   previous key bytes kprefix[0..n-1]; -1 if iv is not (n+3,FF,x) */
+int rc4lab_vote(int n,const unsigned char *kprefix,const unsigned char *iv,unsigned char z);
+
+/* Log-likelihood weight of the vote of iv for key byte n (0 if iv is not
+   (n+3,FF,x) or the vote carries no information), in the same scale as
+   RC4LAB_SUM_WEIGHT, the weight of a sum vote */
+unsigned rc4lab_vote_weight(int n,const unsigned char *iv);
+#define RC4LAB_SUM_WEIGHT 5
+
+/* Candidates sigma[n] for key[0]+..+key[n] (mod 256) from the first nz
+   keystream bytes z of iv, valid for any IV (Klein/PTW votes; each one is
+   right with probability about 1.36/256). Returns how many were stored:
+   nz-2, i.e. the known keystream must be at least n+3 bytes long to vote
+   for sum n. */
+int rc4lab_sum_votes(const unsigned char *iv,const unsigned char *z,int nz,unsigned char *sigma);
+
+rc4lab_votes *rc4lab_votes_new(int npos);
+void rc4lab_votes_free(rc4lab_votes *v);
+void rc4lab_votes_clear(rc4lab_votes *v,int pos);
+void rc4lab_votes_add(rc4lab_votes *v,int pos,int value,unsigned weight);
+unsigned rc4lab_votes_get(const rc4lab_votes *v,int pos,int value);
+/* Most voted value at pos (the smallest one on ties), restricted to the
+   values with allowed[value]!=0 if allowed is not NULL */
+int rc4lab_votes_best(const rc4lab_votes *v,int pos,const unsigned char *allowed,unsigned *freq);
+
+/* Hexadecimal encoding */
+
+int rc4lab_hexval(int c);
+/* Decodes len hex digits (len even); returns the number of bytes or -1 */
+long rc4lab_hex_decode(const char *hex,size_t len,unsigned char *out);
+/* Writes 2n uppercase digits and a terminating null */
+void rc4lab_hex_encode(const unsigned char *in,size_t n,char *out);
+
+/* Capture records */
+
+/* Parses a record line; returns the number of data bytes stored in c (at
+   most maxc) or -1 if the line is malformed */
+int rc4lab_parse_record(const char *line,unsigned char *iv,unsigned char *c,int maxc);
+/* Writes a record line (without newline); returns its length */
+int rc4lab_format_record(char *out,const unsigned char *iv,const unsigned char *c,int nc);
+
+/* Streamed input files, decompressed on the fly when they are gzip or zstd
+   (if the library was built with them). Reading and decompression run in a
+   separate thread. */
+
+typedef struct rc4lab_stream rc4lab_stream;
+
+/* NULL on error (with errno set; ENOTSUP for unsupported compressions) */
+rc4lab_stream *rc4lab_stream_open(const char *path);
+void rc4lab_stream_close(rc4lab_stream *st);
+/* Next block of data (*len bytes), valid until the next call; NULL at the
+   end */
+const unsigned char *rc4lab_stream_chunk(rc4lab_stream *st,size_t *len);
+/* Like fgets */
+char *rc4lab_stream_gets(char *buf,int size,rc4lab_stream *st);
+/* Nonzero if reading or decompression failed */
+int rc4lab_stream_error(rc4lab_stream *st);
+/* Bytes read from the file and bytes returned so far */
+void rc4lab_stream_stats(rc4lab_stream *st,size_t *in,size_t *out);
+
+/* 802.11 captures (pcap and pcapng, plain 802.11, radiotap, prism or AVS
+   headers), possibly compressed */
+
+typedef struct rc4lab_pcap rc4lab_pcap;
+
+/* WEP data frame. body points into the capture and holds len ciphertext
+   bytes (without the ICV); it is valid until the capture is closed, or only
+   until the next rc4lab_pcap_next() for compressed captures */
+typedef struct {
+    unsigned char iv[RC4LAB_IVLEN];
+    unsigned char keyid;
+    unsigned char bssid[6];
+    const unsigned char *body;
+    size_t len;
+} rc4lab_frame;
+
+/* NULL on error (with errno set) */
+rc4lab_pcap *rc4lab_pcap_open(const char *path);
+void rc4lab_pcap_close(rc4lab_pcap *pc);
+/* Next WEP data frame: 1, 0 at the end of the capture, -1 if malformed */
+int rc4lab_pcap_next(rc4lab_pcap *pc,rc4lab_frame *fr);
+/* Bytes of the (uncompressed) capture consumed so far */
+size_t rc4lab_pcap_offset(const rc4lab_pcap *pc);
+/* Keystream bytes of a frame derived from the known LLC/SNAP plaintext
+   (AA AA 03 00 00 00 08 00, i.e. IPv4); returns how many were stored in z
+   (at most maxz, and at most 8) */
+int rc4lab_frame_keystream(const rc4lab_frame *fr,unsigned char *z,int maxz);
+
+/* Capture store: records (IV and up to 8 keystream bytes) of one network
+   deduplicated and bucketed by IV, in an appendable file mapped in memory.
+   Bucket iv[0]<<8|iv[1] holds all the records with those IV bytes, e.g.
+   bucket (n+3)<<8|0xFF the IVs (n+3,FF,x) of key byte n. */
+
+typedef struct rc4lab_store rc4lab_store;
+
+typedef struct {
+    unsigned char iv[RC4LAB_IVLEN];
+    unsigned char nz;               /* Keystream bytes in z */
+    unsigned char z[8];
+} rc4lab_storerec;
+
+/* Creates the store if writable and missing; NULL on error (with errno
+   set) */
+rc4lab_store *rc4lab_store_open(const char *path,int writable);
+void rc4lab_store_close(rc4lab_store *s);
+/* BSSID of the network of the store, NULL while it has no records */
+const unsigned char *rc4lab_store_bssid(const rc4lab_store *s);
+/* Adds the n records of network bssid (sorting r in place) that are not in
+   the store yet, as a new segment; returns how many or -1 on error (EINVAL
+   if the store holds another network). Concurrent appends, also from other
+   processes, are serialised with a file lock. Previous bucket pointers
+   become invalid. */
+long rc4lab_store_append(rc4lab_store *s,const unsigned char *bssid,rc4lab_storerec *r,size_t n);
+int rc4lab_store_segments(const rc4lab_store *s);
+/* Records of a bucket in segment seg (*n of them, sorted), NULL if none */
+const rc4lab_storerec *rc4lab_store_bucket(const rc4lab_store *s,int seg,unsigned bucket,size_t *n);
+/* Records and bytes in the store */
+void rc4lab_store_stats(const rc4lab_store *s,size_t *nrec,size_t *bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,291 @@
+/*! librc4lab: capture store.
+ *
+ * A store file is a header followed by segments, each written by one
+ * rc4lab_store_append(). A segment holds its records sorted (byte-wise, so
+ * by bucket, i.e. the first two IV bytes, then by the rest of the IV and the
+ * keystream) and a sparse index with the position and size of every
+ * nonempty bucket. Appended records are deduplicated among themselves and
+ * against the segments already in the store, with binary searches inside
+ * the buckets. The file is mapped in memory, so reading a bucket only
+ * touches the pages of that bucket (and of the indexes).
+ *
+ * A segment is only complete when its last byte is written: an append cut
+ * short leaves a trailing partial segment, which is ignored when the store
+ * is opened and overwritten by the next append.
+ *
+ * Appends (and the creation of the header) hold an exclusive flock() on the
+ * file and reload it first, so concurrent appends from several processes
+ * are serialised and see each other's segments.
+ *
+ * All the records of a store come from one network: the first append writes
+ * its BSSID in the header (before the segment), and appends from another
+ * network are refused.
+ *
+ * Layout (little endian):
+ *   header:  "RC4S", version (4 bytes), BSSID set (1 byte), BSSID (6 bytes),
+ *            padding (1 byte)
+ *   segment: "SEG1", number of index entries (4 bytes), number of records
+ *            (8 bytes), index entries (bucket, records, first record: 4, 4
+ *            and 8 bytes), records (12 bytes each), padding to 8 bytes
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "rc4lab.h"
+
+#define STORE_VERSION 2
+#define HEADER 16
+#define SEGHEADER 16
+#define ENTRY 16
+
+_Static_assert(sizeof(rc4lab_storerec) == 12, "rc4lab_storerec must be packed");
+
+typedef struct {
+    const unsigned char *index;     /* nbuckets entries */
+    uint32_t nbuckets;
+    const rc4lab_storerec *rec;
+    uint64_t nrec;
+} segment;
+
+struct rc4lab_store {
+    int fd;
+    int writable;
+    const unsigned char *base;      /* Mapped file */
+    size_t mapped;                  /* Mapped size */
+    size_t size;                    /* Valid size (without a partial segment) */
+    int has_bssid;
+    unsigned char bssid[6];
+    segment *seg;
+    int nseg;
+};
+
+static uint32_t le32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t le64(const unsigned char *p) {
+    return le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+static void put32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = v >> 8 * i;
+}
+
+static void put64(unsigned char *p, uint64_t v) {
+    put32(p, v);
+    put32(p + 4, v >> 32);
+}
+
+static size_t segsize(uint32_t nbuckets, uint64_t nrec) {
+    return (SEGHEADER + (size_t)nbuckets * ENTRY + nrec * sizeof(rc4lab_storerec) + 7) & ~(size_t)7;
+}
+
+/* Maps the file and walks its complete segments */
+static int load(rc4lab_store *s) {
+    struct stat sb;
+    if (s->base) munmap((void *)s->base, s->mapped);
+    s->base = NULL;
+    s->nseg = 0;
+    if (fstat(s->fd, &sb) < 0) return -1;
+    if (sb.st_size < HEADER) {
+        errno = EINVAL;
+        return -1;
+    }
+    void *m = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, s->fd, 0);
+    if (m == MAP_FAILED) return -1;
+    s->base = m;
+    s->mapped = s->size = sb.st_size;
+    if (memcmp(s->base, "RC4S", 4) || le32(s->base + 4) != STORE_VERSION) {
+        errno = EINVAL;
+        return -1;
+    }
+    s->has_bssid = s->base[8];
+    memcpy(s->bssid, s->base + 9, 6);
+    size_t pos = HEADER;
+    int cap = 0;
+    while (s->size - pos >= SEGHEADER && !memcmp(s->base + pos, "SEG1", 4)) {
+        const unsigned char *h = s->base + pos;
+        uint32_t nb = le32(h + 4);
+        uint64_t nrec = le64(h + 8);
+        if (nrec > s->size / sizeof(rc4lab_storerec) || segsize(nb, nrec) > s->size - pos) break;
+        if (s->nseg == cap) {
+            segment *sg = realloc(s->seg, (cap = cap ? 2 * cap : 16) * sizeof(segment));
+            if (!sg) return -1;
+            s->seg = sg;
+        }
+        segment *sg = &s->seg[s->nseg++];
+        sg->index = h + SEGHEADER;
+        sg->nbuckets = nb;
+        sg->rec = (const rc4lab_storerec *)(sg->index + (size_t)nb * ENTRY);
+        sg->nrec = nrec;
+        pos += segsize(nb, nrec);
+    }
+    s->size = pos;      /* Without a partial segment at the end */
+    return 0;
+}
+
+rc4lab_store *rc4lab_store_open(const char *path, int writable) {
+    rc4lab_store *s = calloc(1, sizeof(rc4lab_store));
+    if (!s) return NULL;
+    s->writable = writable;
+    if ((s->fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644)) < 0) {
+        free(s);
+        return NULL;
+    }
+    struct stat sb;
+    if (writable) {
+        if (flock(s->fd, LOCK_EX) < 0) goto fail;
+        if (!fstat(s->fd, &sb) && sb.st_size == 0) {
+            unsigned char h[HEADER] = {0};
+            memcpy(h, "RC4S", 4);
+            put32(h + 4, STORE_VERSION);
+            if (write(s->fd, h, HEADER) != HEADER) goto fail;
+        }
+        flock(s->fd, LOCK_UN);
+    }
+    if (load(s) < 0) goto fail;
+    return s;
+fail:
+    {
+        int e = errno;
+        rc4lab_store_close(s);
+        errno = e;
+    }
+    return NULL;
+}
+
+void rc4lab_store_close(rc4lab_store *s) {
+    if (!s) return;
+    if (s->base) munmap((void *)s->base, s->mapped);
+    close(s->fd);
+    free(s->seg);
+    free(s);
+}
+
+static int reccmp(const void *a, const void *b) {
+    return memcmp(a, b, sizeof(rc4lab_storerec));
+}
+
+/* Index entry of bucket in sg, NULL if empty */
+static const unsigned char *find_bucket(const segment *sg, unsigned bucket) {
+    uint32_t lo = 0, hi = sg->nbuckets;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        uint32_t b = le32(sg->index + (size_t)mid * ENTRY);
+        if (b == bucket) return sg->index + (size_t)mid * ENTRY;
+        if (b < bucket) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+const rc4lab_storerec *rc4lab_store_bucket(const rc4lab_store *s, int seg, unsigned bucket, size_t *n) {
+    const unsigned char *e = find_bucket(&s->seg[seg], bucket);
+    *n = e ? le32(e + 4) : 0;
+    return e ? s->seg[seg].rec + le64(e + 8) : NULL;
+}
+
+static int in_store(const rc4lab_store *s, const rc4lab_storerec *r) {
+    for (int i = 0; i < s->nseg; i++) {
+        size_t n;
+        const rc4lab_storerec *b = rc4lab_store_bucket(s, i, r->iv[0] << 8 | r->iv[1], &n);
+        if (b && bsearch(r, b, n, sizeof(*r), reccmp)) return 1;
+    }
+    return 0;
+}
+
+const unsigned char *rc4lab_store_bssid(const rc4lab_store *s) {
+    return s->has_bssid ? s->bssid : NULL;
+}
+
+/* With the lock held, on the store as reloaded */
+static long append_locked(rc4lab_store *s, const unsigned char *bssid, rc4lab_storerec *r, size_t n) {
+    if (load(s) < 0) return -1;
+    if (s->has_bssid && memcmp(s->bssid, bssid, 6)) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* Canonical records: keystream bytes past nz are zero */
+    for (size_t i = 0; i < n; i++) {
+        if (r[i].nz > sizeof(r[i].z)) r[i].nz = sizeof(r[i].z);
+        memset(r[i].z + r[i].nz, 0, sizeof(r[i].z) - r[i].nz);
+    }
+    qsort(r, n, sizeof(*r), reccmp);
+    size_t m = 0;
+    uint32_t nb = 0;
+    for (size_t i = 0; i < n; i++) {
+        if ((m && !reccmp(&r[m - 1], &r[i])) || in_store(s, &r[i])) continue;
+        if (!m || r[m - 1].iv[0] != r[i].iv[0] || r[m - 1].iv[1] != r[i].iv[1]) nb++;
+        r[m++] = r[i];
+    }
+    if (!m) return 0;
+    if (!s->has_bssid) {
+        unsigned char h[8] = {1};
+        memcpy(h + 1, bssid, 6);
+        if (pwrite(s->fd, h, sizeof(h), 8) != sizeof(h)) return -1;
+        s->has_bssid = 1;
+        memcpy(s->bssid, bssid, 6);
+    }
+    size_t size = segsize(nb, m);
+    unsigned char *seg = calloc(1, size);
+    if (!seg) return -1;
+    memcpy(seg, "SEG1", 4);
+    put32(seg + 4, nb);
+    put64(seg + 8, m);
+    unsigned char *e = seg + SEGHEADER - ENTRY;
+    for (size_t i = 0; i < m; i++) {
+        unsigned bucket = r[i].iv[0] << 8 | r[i].iv[1];
+        if (!i || bucket != le32(e)) {
+            e += ENTRY;
+            put32(e, bucket);
+            put64(e + 8, i);
+        }
+        put32(e + 4, le32(e + 4) + 1);
+    }
+    memcpy(seg + SEGHEADER + (size_t)nb * ENTRY, r, m * sizeof(*r));
+    /* Over a partial segment left by an interrupted append, if any */
+    size_t done = 0;
+    while (done < size) {
+        ssize_t w = pwrite(s->fd, seg + done, size - done, s->size + done);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            free(seg);
+            return -1;
+        }
+        done += w;
+    }
+    free(seg);
+    if (ftruncate(s->fd, s->size + size) < 0 || load(s) < 0) return -1;
+    return m;
+}
+
+long rc4lab_store_append(rc4lab_store *s, const unsigned char *bssid, rc4lab_storerec *r, size_t n) {
+    if (!s->writable) {
+        errno = EBADF;
+        return -1;
+    }
+    if (flock(s->fd, LOCK_EX) < 0) return -1;
+    long m = append_locked(s, bssid, r, n);
+    int e = errno;
+    flock(s->fd, LOCK_UN);
+    errno = e;
+    return m;
+}
+
+int rc4lab_store_segments(const rc4lab_store *s) {
+    return s->nseg;
+}
+
+void rc4lab_store_stats(const rc4lab_store *s, size_t *nrec, size_t *bytes) {
+    size_t n = 0;
+    for (int i = 0; i < s->nseg; i++) n += s->seg[i].nrec;
+    if (nrec) *nrec = n;
+    if (bytes) *bytes = s->size;
+}
@@ -0,0 +1,308 @@
+/*! librc4lab: streamed (and possibly compressed) input files.
+ *
+ * gzip and zstd files are recognised by their magic numbers. A producer
+ * thread reads and decompresses the file into fixed-size chunks, which are
+ * handed to the consumer through a bounded queue, so decompression overlaps
+ * with the parsing and vote accumulation done by the caller. Plain files go
+ * through the same path, with the thread only doing the reads.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "rc4lab.h"
+
+#define CHUNK (1u << 20)    /* Size of the decompressed chunks */
+#define NSLOT 4             /* Queue length (chunks in flight) */
+#define INBUF (256u << 10)  /* Compressed input buffer */
+
+enum {RAW, GZIP, ZSTD};
+
+struct rc4lab_stream {
+    int fd;
+    int kind;
+    size_t outbytes;                /* Bytes handed to the consumer */
+    /* Queue and input statistics (protected by mx) */
+    pthread_t th;
+    pthread_mutex_t mx;
+    pthread_cond_t notfull, notempty;
+    unsigned char *slot[NSLOT];
+    size_t len[NSLOT];
+    int head, count;
+    int eof, err, stop;
+    size_t inbytes;                 /* Bytes read from the file */
+    int ended;                      /* Compressed stream complete (not truncated) */
+    /* Consumer cursor in the current chunk */
+    int cur;
+    size_t off;
+    /* Producer input buffer */
+    unsigned char *in;
+    size_t inlen, inpos;
+};
+
+static void count_input(rc4lab_stream *st, size_t n) {
+    pthread_mutex_lock(&st->mx);
+    st->inbytes += n;
+    pthread_mutex_unlock(&st->mx);
+}
+
+static int fill_input(rc4lab_stream *st) {
+    ssize_t n;
+    do n = read(st->fd, st->in, INBUF);
+    while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
+    st->inlen = n;
+    st->inpos = 0;
+    count_input(st, n);
+    return n > 0;
+}
+
+/* Fills out with up to CHUNK bytes; returns how many (0 at the end, -1 on
+   errors) */
+
+static long produce_raw(rc4lab_stream *st, unsigned char *out) {
+    size_t n = 0;
+    while (n < CHUNK) {
+        ssize_t r = read(st->fd, out + n, CHUNK - n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return -1;
+        if (!r) break;
+        n += r;
+    }
+    count_input(st, n);
+    return n;
+}
+
+#ifdef HAVE_ZLIB
+static long produce_gzip(rc4lab_stream *st, z_stream *zs, unsigned char *out) {
+    zs->next_out = out;
+    zs->avail_out = CHUNK;
+    while (zs->avail_out) {
+        if (!zs->avail_in) {
+            int r = fill_input(st);
+            if (r < 0 || (!r && !st->ended)) return -1;
+            if (!r) break;
+            zs->next_in = st->in;
+            zs->avail_in = st->inlen;
+        }
+        int r = inflate(zs, Z_NO_FLUSH);
+        st->ended = r == Z_STREAM_END;
+        if (r == Z_STREAM_END) {
+            /* Concatenated members */
+            if (inflateReset(zs) != Z_OK) return -1;
+        } else if (r != Z_OK && r != Z_BUF_ERROR) return -1;
+    }
+    return CHUNK - zs->avail_out;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static long produce_zstd(rc4lab_stream *st, ZSTD_DCtx *zd, unsigned char *out) {
+    ZSTD_outBuffer ob = {out, CHUNK, 0};
+    while (ob.pos < ob.size) {
+        if (st->inpos == st->inlen) {
+            int r = fill_input(st);
+            if (r < 0 || (!r && !st->ended)) return -1;
+            if (!r) break;
+        }
+        ZSTD_inBuffer ib = {st->in, st->inlen, st->inpos};
+        size_t r = ZSTD_decompressStream(zd, &ob, &ib);
+        if (ZSTD_isError(r)) return -1;
+        st->ended = r == 0;
+        st->inpos = ib.pos;
+    }
+    return ob.pos;
+}
+#endif
+
+static void *producer(void *arg) {
+    rc4lab_stream *st = arg;
+    int initerr = 0;
+#ifdef HAVE_ZLIB
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (st->kind == GZIP && inflateInit2(&zs, 15 + 32) != Z_OK) initerr = 1;
+    zs.next_in = st->in;
+    zs.avail_in = st->inlen;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *zd = st->kind == ZSTD ? ZSTD_createDCtx() : NULL;
+    if (st->kind == ZSTD && !zd) initerr = 1;
+#endif
+    int slot = 0;
+    for (;;) {
+        pthread_mutex_lock(&st->mx);
+        while (st->count == NSLOT && !st->stop) pthread_cond_wait(&st->notfull, &st->mx);
+        if (initerr) st->err = 1;
+        int done = st->stop || st->err;
+        slot = (st->head + st->count) % NSLOT;
+        pthread_mutex_unlock(&st->mx);
+        if (done) break;
+        long n = -1;
+        switch (st->kind) {
+        case RAW: n = produce_raw(st, st->slot[slot]); break;
+#ifdef HAVE_ZLIB
+        case GZIP: n = produce_gzip(st, &zs, st->slot[slot]); break;
+#endif
+#ifdef HAVE_ZSTD
+        case ZSTD: n = produce_zstd(st, zd, st->slot[slot]); break;
+#endif
+        }
+        pthread_mutex_lock(&st->mx);
+        if (n > 0) {
+            st->len[slot] = n;
+            st->count++;
+        }
+        if (n < 0) st->err = 1;
+        if (n < (long)CHUNK) st->eof = 1;
+        pthread_cond_signal(&st->notempty);
+        done = st->eof;
+        pthread_mutex_unlock(&st->mx);
+        if (done) break;
+    }
+#ifdef HAVE_ZLIB
+    if (st->kind == GZIP) inflateEnd(&zs);
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_freeDCtx(zd);
+#endif
+    pthread_mutex_lock(&st->mx);
+    st->eof = 1;
+    pthread_cond_signal(&st->notempty);
+    pthread_mutex_unlock(&st->mx);
+    return NULL;
+}
+
+rc4lab_stream *rc4lab_stream_open(const char *path) {
+    rc4lab_stream *st = calloc(1, sizeof(rc4lab_stream));
+    if (!st) return NULL;
+    st->cur = -1;
+    pthread_mutex_init(&st->mx, NULL);
+    pthread_cond_init(&st->notfull, NULL);
+    pthread_cond_init(&st->notempty, NULL);
+    if ((st->fd = open(path, O_RDONLY)) < 0) goto fail;
+    st->in = malloc(INBUF);
+    for (int i = 0; i < NSLOT; i++) st->slot[i] = malloc(CHUNK);
+    if (!st->in) goto nomem;
+    for (int i = 0; i < NSLOT; i++) if (!st->slot[i]) goto nomem;
+    if (fill_input(st) < 0) goto fail;
+    const unsigned char *m = st->in;
+    if (st->inlen >= 2 && m[0] == 0x1f && m[1] == 0x8b) st->kind = GZIP;
+    else if (st->inlen >= 4 && m[0] == 0x28 && m[1] == 0xb5 && m[2] == 0x2f && m[3] == 0xfd) st->kind = ZSTD;
+    else st->kind = RAW;
+#ifndef HAVE_ZLIB
+    if (st->kind == GZIP) {errno = ENOTSUP; goto fail;}
+#endif
+#ifndef HAVE_ZSTD
+    if (st->kind == ZSTD) {errno = ENOTSUP; goto fail;}
+#endif
+    if (st->kind == RAW) {
+        /* Start reading from the beginning again */
+        if (lseek(st->fd, 0, SEEK_SET) < 0) goto fail;
+        st->inbytes = 0;
+    }
+    if ((errno = pthread_create(&st->th, NULL, producer, st))) goto fail;
+    return st;
+nomem:
+    errno = ENOMEM;
+fail:
+    {
+        int e = errno;
+        if (st->fd >= 0) close(st->fd);
+        pthread_mutex_destroy(&st->mx);
+        pthread_cond_destroy(&st->notfull);
+        pthread_cond_destroy(&st->notempty);
+        free(st->in);
+        for (int i = 0; i < NSLOT; i++) free(st->slot[i]);
+        free(st);
+        errno = e;
+    }
+    return NULL;
+}
+
+void rc4lab_stream_close(rc4lab_stream *st) {
+    if (!st) return;
+    pthread_mutex_lock(&st->mx);
+    st->stop = 1;
+    pthread_cond_signal(&st->notfull);
+    pthread_mutex_unlock(&st->mx);
+    pthread_join(st->th, NULL);
+    pthread_mutex_destroy(&st->mx);
+    pthread_cond_destroy(&st->notfull);
+    pthread_cond_destroy(&st->notempty);
+    close(st->fd);
+    free(st->in);
+    for (int i = 0; i < NSLOT; i++) free(st->slot[i]);
+    free(st);
+}
+
+/* Makes sure the cursor points to unread data; 0 at the end */
+static int advance_chunk(rc4lab_stream *st) {
+    if (st->cur >= 0 && st->off < st->len[st->cur]) return 1;
+    pthread_mutex_lock(&st->mx);
+    if (st->cur >= 0) {
+        /* Give the consumed chunk back to the producer */
+        st->head = (st->head + 1) % NSLOT;
+        st->count--;
+        st->cur = -1;
+        pthread_cond_signal(&st->notfull);
+    }
+    while (!st->count && !st->eof) pthread_cond_wait(&st->notempty, &st->mx);
+    if (st->count) {
+        st->cur = st->head;
+        st->off = 0;
+    }
+    pthread_mutex_unlock(&st->mx);
+    return st->cur >= 0;
+}
+
+const unsigned char *rc4lab_stream_chunk(rc4lab_stream *st, size_t *len) {
+    if (!advance_chunk(st)) return NULL;
+    const unsigned char *p = st->slot[st->cur] + st->off;
+    *len = st->len[st->cur] - st->off;
+    st->off = st->len[st->cur];
+    st->outbytes += *len;
+    return p;
+}
+
+char *rc4lab_stream_gets(char *buf, int size, rc4lab_stream *st) {
+    int n = 0;
+    while (n < size - 1 && advance_chunk(st)) {
+        const unsigned char *p = st->slot[st->cur] + st->off;
+        size_t avail = st->len[st->cur] - st->off;
+        size_t k = avail < (size_t)(size - 1 - n) ? avail : (size_t)(size - 1 - n);
+        const unsigned char *nl = memchr(p, '\n', k);
+        if (nl) k = nl - p + 1;
+        memcpy(buf + n, p, k);
+        n += k;
+        st->off += k;
+        st->outbytes += k;
+        if (nl) break;
+    }
+    if (!n) return NULL;
+    buf[n] = 0;
+    return buf;
+}
+
+int rc4lab_stream_error(rc4lab_stream *st) {
+    pthread_mutex_lock(&st->mx);
+    int err = st->err;
+    pthread_mutex_unlock(&st->mx);
+    return err;
+}
+
+void rc4lab_stream_stats(rc4lab_stream *st, size_t *in, size_t *out) {
+    pthread_mutex_lock(&st->mx);
+    if (in) *in = st->inbytes;
+    pthread_mutex_unlock(&st->mx);
+    if (out) *out = st->outbytes;
+}
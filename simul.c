@@ -2,8 +2,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <openssl/rc4.h>
 #include <openssl/rand.h>
+#include "rc4lab.h"
 
 #define IVL    3
 #define KL    13
@@ -19,7 +19,7 @@ FILE *f;
 
 void getIV(){
     printf("Enter iv(3B): ");
-    for(int i = 0; i < IVL; i++) scanf("%2X", &IV[i]);
+    for(int i = 0; i < IVL; i++) scanf("%2hhX", &IV[i]);
     IV[IVL] = '\0';
 
     printf("IV: 0x");
@@ -30,7 +30,7 @@ void getIV(){
 
 void getK(){
     printf("Enter Key(13B): ");
-    for(int i = 0; i < KL; i++) scanf("%2X", &Key[i]);
+    for(int i = 0; i < KL; i++) scanf("%2hhX", &Key[i]);
     Key[KL] = '\0';
 
     printf("Key: 0x");
@@ -41,7 +41,7 @@ void getK(){
 
 void getM(){
     printf("Enter Message(1B): ");
-    for(int i = 0; i < ML; i++) scanf("%2X", &M[i]);
+    for(int i = 0; i < ML; i++) scanf("%2hhX", &M[i]);
     M[ML] = '\0';
 
     printf("Message: 0x");
@@ -51,32 +51,13 @@ void getM(){
 }
 
 void generate_key(){
-    RAND_bytes(Key, KEYL);
-    Key[KEYL] = '\0';
+    RAND_bytes(Key, KL);
+    Key[KL] = '\0';
     printf("Key: 0x");
     for (int i = 0 ; i < KL; i++) printf("%02X", Key[i]);
     printf("\n");
 }
 
-char* hex2str(unsigned char *r, int l){
-    char *n = malloc(l * 2 + 1);
-    for (int i = 0 ; i < l; i++){
-        sprintf(n + i * 2, "%02X", r[i]);
-    }
-    n[l * 2] = '\0';
-    return n;
-}
-
-char* int2uchar(unsigned int r, int l){
-    char *n = malloc(l + 1);
-    for (int i = 0 ; i < l; i++){
-        n[i] = r >> 16 - (i*8);
-    }
-    n[l] = '\0';
-    // printf("prov: %06X\n", *n);
-    return n;
-}
-
 void generate_message(){
     RAND_bytes(M, ML);
     M[ML] = '\0';
@@ -87,15 +68,19 @@ void generate_message(){
 
 FILE* open_file(){
     char name[IVL*2 + 4 + 1];
-    sprintf(name, "%s.dat", hex2str(IV, IVL));
+    rc4lab_hex_encode(IV, IVL, name);
+    strcat(name, ".dat");
     return fopen(name, "w");
 }
 
 void close_file(){
-    fclose(f);
+    if (fclose(f) != 0){
+        perror("fclose(): ");
+        exit(1);
+    }
 }
 
-char* concatKey(unsigned char iv[IVL]){
+unsigned char* concatKey(unsigned char iv[IVL]){
     unsigned char *k = malloc(KEYL + 1);
     for (int i = 0 ; i < IVL; i++) k[i] = iv[i];
     for (int i = 0 ; i < KL; i++) k[3+i] = Key[i];
@@ -116,25 +101,28 @@ void write_file(char *data){
 
 char* main_process(unsigned char *k){
     unsigned char C[ML + 1];
-    RC4_KEY ky;
-    RC4_set_key(&ky, KEYL, k);
-    RC4(&ky, ML, M, C);
+    rc4lab_ctx *ky = rc4lab_new();
+    rc4lab_setkey(ky, k, KEYL);
+    rc4lab_xor(ky, M, C, ML);
+    rc4lab_free(ky);
     C[ML] = '\0';
 
     const int lout = 2+(IVL*2)+1+2+(ML*2)+1;
     char *out = malloc(lout);
-    sprintf(out, "0x%02X%02X%02X 0x%02X", k[0], k[1], k[2], C[0]);
-    out[lout] = '\0';
-    // out[lout+1] = '\n';
+    rc4lab_format_record(out, k, C, ML);
     return out;
 }
 
 void process_iter(){   
-    unsigned int ivint = (0x00 << 24 | IV[0] << 16 | IV[1] << 8 | IV[2]);
+    unsigned char iv[IVL];
+    memcpy(iv, IV, IVL);
     for (int iter = 0; iter < ITER ; iter++){
-        unsigned char *k = concatKey(int2uchar(ivint, IVL));
-        write_file(main_process(k));    
-        ivint++;
+        unsigned char *k = concatKey(iv);
+        char *out = main_process(k);
+        write_file(out);
+        free(out);
+        free(k);
+        if (++iv[2] == 0 && ++iv[1] == 0) iv[0]++;
     }
 }
 
@@ -144,6 +132,48 @@ void process_enc(){
     close_file();
 }
 
+// Broadcast ciphertexts (-b): n encryptions of the message under random,
+// independent 16-byte keys, written as "RC4C", the message length (32-bit
+// little endian) and the ciphertexts (the input of attack -M).
+
+#define BC_BLOCK 4096
+
+void process_broadcast(long n, const char *msg, const char *name){
+    int len = strlen(msg);
+    unsigned char keys[BC_BLOCK][KEYL];
+    unsigned char hdr[8] = {'R', 'C', '4', 'C', len, len >> 8, len >> 16, len >> 24};
+    unsigned char *C = malloc((size_t)BC_BLOCK * len);
+    rc4lab_ctx *ky = rc4lab_new();
+    if (C == NULL || ky == NULL){
+        perror("malloc(): ");
+        exit(1);
+    }
+    if ((f = fopen(name, "wb")) == NULL){
+        perror(name);
+        exit(1);
+    }
+    if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr)){
+        perror("fwrite(): ");
+        exit(1);
+    }
+    while (n > 0){
+        int b = n < BC_BLOCK ? n : BC_BLOCK;
+        RAND_bytes(&keys[0][0], b * KEYL);
+        for (int i = 0 ; i < b ; i++){
+            rc4lab_setkey(ky, keys[i], KEYL);
+            rc4lab_xor(ky, (const unsigned char *)msg, C + (size_t)i * len, len);
+        }
+        if (fwrite(C, len, b, f) != (size_t)b){
+            perror("fwrite(): ");
+            exit(1);
+        }
+        n -= b;
+    }
+    close_file();
+    rc4lab_free(ky);
+    free(C);
+}
+
 void checkOpt(char *opt){
     if(strcmp(opt, "-k") == 0){
         generate_key();
@@ -160,10 +190,12 @@ void checkOpt(char *opt){
 }
 
 int main (int argc, char *argv[]){
-    if (argc > 1) checkOpt(argv[1]);
+    if (argc > 4 && strcmp(argv[1], "-b") == 0) process_broadcast(strtod(argv[2], NULL), argv[3], argv[4]);
+    else if (argc > 1) checkOpt(argv[1]);
     else printf("Usage: \n \
                 -k(Generates Key 13B) \n \
                 -m(generates message 1B) \n \
-                -e(RC4 through iterating iv 256 times)\n");
+                -e(RC4 through iterating iv 256 times) \n \
+                -b <n> <message> <file>(n encryptions of message under random keys)\n");
     return 0;
 }